@@ -7,56 +7,54 @@ void Box::update()
     transform = center;
 }
 
-bool Box::hit(const Ray& r, const double t_min, const double t_max, HitData& data) const
+bool Box::intersect(const TraversalRay& ray, HitData& data) const
 {
-    double tmin, tmax, tymin, tymax, tzmin, tzmax;
-    int r_sign[3];
-    Vec3 r_invdir = 1.0f / r.direction();
+    Real t_enter, t_exit;
+    slab_test(ray, boundingBox.low, boundingBox.high, t_enter, t_exit);
 
-    for (int i = 0; i < 3; ++i)
-    {
-        r_sign[i] = r_invdir[i] < 0 ? 1 : 0;
-    }
-
-    Vec3 bounds[2] = {boundingBox.low, boundingBox.high};
-
-    tmin = (bounds[r_sign[0]].x() - r.origin().x()) * r_invdir.x();
-    tmax = (bounds[1 - r_sign[0]].x() - r.origin().x()) * r_invdir.x();
-    tymin = (bounds[r_sign[1]].y() - r.origin().y()) * r_invdir.y();
-    tymax = (bounds[1 - r_sign[1]].y() - r.origin().y()) * r_invdir.y();
-
-    if ((tmin > tymax) || (tymin > tmax))
+    // Rays starting inside the box hit it where they leave
+    const Real t = t_enter >= ray.t_min ? t_enter : t_exit;
+    if (t_enter > t_exit || t < ray.t_min || t > ray.t_max)
         return false;
 
-    if (tymin > tmin)
-        tmin = tymin;
-    if (tymax < tmax)
-        tmax = tymax;
-
-    tzmin = (bounds[r_sign[2]].z() - r.origin().z()) * r_invdir.z();
-    tzmax = (bounds[1 - r_sign[2]].z() - r.origin().z()) * r_invdir.z();
-
-    if ((tmin > tzmax) || (tzmin > tmax))
-        return false;
+    data.t = t;
+    data.entity = this;
+    return true;
+}
 
-    if (tzmin > tmin)
-        tmin = tzmin;
-    if (tzmax < tmax)
-        tmax = tzmax;
+bool Box::occludes(const TraversalRay& ray) const
+{
+    Real t_enter, t_exit;
+    slab_test(ray, boundingBox.low, boundingBox.high, t_enter, t_exit);
+    const Real t = t_enter >= ray.t_min ? t_enter : t_exit;
+    return !(t_enter > t_exit || t < ray.t_min || t > ray.t_max);
+}
 
-    double t = tmin;
+PacketMask Box::hitPacket(const RayPacket& packet, const PacketMask& active, const Real t_min,
+                          PacketReal& closest, HitPacket& data) const
+{
+    PacketReal t;
+    const PacketMask hits = box_packet_test(packet, active, t_min, closest, boundingBox.low, boundingBox.high, t);
+    if (!Simd::any(hits))
+    {
+        return hits;
+    }
 
-    if (t < 0)
+    closest = Simd::select(hits, t, closest);
+    for (int lane = 0; lane < PACKET_SIZE; ++lane)
     {
-        t = tmax;
-        if (t < 0)
-            return false;
+        if (hits[lane])
+        {
+            data[lane].t = t[lane];
+            data[lane].entity = this;
+        }
     }
-    if (t > t_max || t < t_min)
-        return false;
+    return hits;
+}
 
-    data.t = t;
-    data.hit_point = r.pointAt(t);
+void Box::interact(const Ray& r, HitData& data) const
+{
+    data.hit_point = r.pointAt(data.t);
     const Vec3 direction = data.hit_point - transform;
     const Vec3 normal =
         (std::abs(direction[0]) > std::abs(direction[1]) && std::abs(direction[0]) > std::abs(direction[2]))
@@ -65,6 +63,11 @@ bool Box::hit(const Ray& r, const double t_min, const double t_max, HitData& dat
                                                      : Vec3(0, 0, direction[2]));
     data.normal = normal / dimensions;
     data.material = material;
-    data.entity = shared_from_this();
+    data.entity = this;
+}
+
+bool Box::surfaceMaterial(MaterialId& material) const
+{
+    material = this->material;
     return true;
-}
\ No newline at end of file
+}
@@ -1,24 +1,38 @@
 #pragma once
 
-#include <memory>
-#include <utility>
-
 #include "entity.hpp"
 
 class Box : public Entity
 {
   public:
-    Box(Vec3 center, Vec3 dimensions, std::shared_ptr<Material> material)
+    Box(Vec3 center, Vec3 dimensions, MaterialId material)
         : center(center)
         , dimensions(dimensions)
-        , material(std::move(material))
+        , material(material)
     {
         Box::update();
     }
     void update() override;
-    bool hit(const Ray& r, const double t_min, const double t_max,
-                     HitData& data) const override;
+    bool intersect(const TraversalRay& ray, HitData& data) const override;
+    bool occludes(const TraversalRay& ray) const override;
+    void interact(const Ray& r, HitData& data) const override;
+    bool surfaceMaterial(MaterialId& material) const override;
+    PacketMask hitPacket(const RayPacket& packet, const PacketMask& active, const Real t_min,
+                         PacketReal& closest, HitPacket& data) const override;
     Vec3 center;
     Vec3 dimensions;
-    std::shared_ptr<Material> material;
+    MaterialId material;
 };
+
+// Intersects the active lanes of a packet with the box [low, high]. Returns the lanes that hit
+// within [t_min, closest] and their distance in `t`, rays starting inside hit where they leave.
+inline PacketMask box_packet_test(const RayPacket& packet, const PacketMask& active, const Real t_min,
+                                  const PacketReal& closest, const Vec3& low, const Vec3& high, PacketReal& t)
+{
+    PacketReal t_enter, t_exit;
+    slab_test(packet, low, high, t_enter, t_exit);
+
+    const PacketReal lower = Simd::broadcast(t_min);
+    t = Simd::select(t_enter >= lower, t_enter, t_exit);
+    return active & (t_enter <= t_exit) & (t >= lower) & (t <= closest);
+}
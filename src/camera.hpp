@@ -6,7 +6,7 @@
 class Camera: public Entity
 {
     public:
-        Camera(const Vec3 &position, const Vec3 &look_at, const double vFOV, const double aspect_ratio):
+        Camera(const Vec3 &position, const Vec3 &look_at, const Real vFOV, const Real aspect_ratio):
             // bottom_left(-2.0, -1.0, -1.0),
             // horizontal(2.0, 0.0, 0.0),
             // vertical(0.0, 1.0, 0.0),
@@ -19,29 +19,46 @@ class Camera: public Entity
             Camera::update();
         }
 
-        Ray getRay(const double u, const double v) const;
+        Ray getRay(const Real u, const Real v) const;
+        // Inverse of getRay(): the image coordinates at which `point` is seen, false if it is behind the camera
+        bool project(const Vec3 &point, Real &u, Real &v) const;
 
         virtual void update() override;
-        virtual bool hit(const Ray &r, const double t_min, const double t_max, HitData &data) const override;
+        virtual bool intersect(const TraversalRay &ray, HitData &data) const override;
 
         Vec3 bottom_left;
         Vec3 horizontal;
         Vec3 vertical;
         Vec3 look_at;
         Vec3 up;
-        double vFOV;
-        double aspect_ratio;
+        Real vFOV;
+        Real aspect_ratio;
 };
 
-Ray Camera::getRay(const double u, const double v) const
+Ray Camera::getRay(const Real u, const Real v) const
 {
     return Ray(transform, (bottom_left + u * horizontal + v * vertical).normalized());
 }
 
+bool Camera::project(const Vec3 &point, Real &u, Real &v) const
+{
+    // horizontal, vertical and the view direction are orthogonal
+    const Vec3 direction = bottom_left + (horizontal + vertical) / 2.0f;
+    const Vec3 offset = point - transform;
+    const Real distance = offset.dot(direction);
+    if (distance <= 0)
+    {
+        return false;
+    }
+    u = offset.dot(horizontal) / (horizontal.dot(horizontal) * distance) + 0.5f;
+    v = offset.dot(vertical) / (vertical.dot(vertical) * distance) + 0.5f;
+    return true;
+}
+
 void Camera::update()
 {
-    double height = tan(vFOV * M_PI / 180 / 2) * 2;
-    double width = height * aspect_ratio;
+    Real height = tan(vFOV * M_PI / 180 / 2) * 2;
+    Real width = height * aspect_ratio;
     Vec3 direction = (look_at - transform).normalized();
     horizontal = (direction.cross(up)).normalized();
     vertical = horizontal.cross(direction);
@@ -52,7 +69,7 @@ void Camera::update()
     bottom_left = direction - (vertical + horizontal) / 2.0f;
 }
 
-bool Camera::hit(const Ray &r, const double t_min, const double t_max, HitData &data) const
+bool Camera::intersect(const TraversalRay &ray, HitData &data) const
 {
     return false;
 }
\ No newline at end of file
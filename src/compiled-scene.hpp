@@ -0,0 +1,343 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "kdtree-node.hpp"
+#include "kdtree-scene.hpp"
+#include "scene-description.hpp"
+#include "shared-array.hpp"
+#include "triangle-mesh.hpp"
+
+// Binary form of a scene: a header followed by raw arrays of the scene description and the built
+// tree, each starting at a cache line boundary. Loading maps the file and traces the scene tree and
+// the mesh buffers and trees right from the mapping, only the small description arrays are copied,
+// so neither the text is parsed nor a tree is built again. The arrays hold the in-memory layout of
+// this build, the header records the type sizes so other configurations reject the file.
+// Triangle meshes are stored as records pointing into shared vertex, index and mesh tree arrays,
+// instances as their transform and the index of their mesh record.
+struct CompiledScene
+{
+    static constexpr char MAGIC[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+    static constexpr uint32_t VERSION = 3;
+    static constexpr uint64_t ALIGNMENT = 64;
+
+    struct Section
+    {
+        uint64_t offset;
+        uint64_t count;
+    };
+
+    struct MeshRecord
+    {
+        MaterialId material;
+        uint32_t emissive;
+        uint32_t placed;
+        Section positions;
+        Section indices;
+        Section nodes;
+    };
+
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t real_size;
+        uint32_t vec3_size;
+        uint32_t material_size;
+        int32_t frames;
+        uint32_t builder;
+        double vertical_fov;
+        Section camera_keys;
+        Section materials;
+        Section spheres;
+        Section boxes;
+        Section meshes;
+        Section mesh_positions;
+        Section mesh_indices;
+        Section mesh_nodes;
+        Section instances;
+        Section nodes;
+        Section primitive_indices;
+    };
+};
+
+// Private memory mapping of a whole file. The pages are copy-on-write, so refitting a mapped tree
+// copies the pages it changes and never writes to the file.
+class MappedFile
+{
+    public:
+        explicit MappedFile(const std::string &path);
+        ~MappedFile();
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+
+        bool valid() const { return data_ != nullptr; }
+        char* data() const { return data_; }
+        size_t size() const { return size_; }
+
+    private:
+        char *data_ = nullptr;
+        size_t size_ = 0;
+};
+
+MappedFile::MappedFile(const std::string &path)
+{
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        return;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0)
+    {
+        void *mapping = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED)
+        {
+            data_ = static_cast<char*>(mapping);
+            size_ = info.st_size;
+        }
+    }
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (data_)
+    {
+        munmap(data_, size_);
+    }
+}
+
+// Writes `description` together with the tree `scene` built from it
+bool write_compiled_scene(const std::string &path, const SceneDescription &description, const KDTreeScene &scene)
+{
+    std::ofstream file(path, std::ios::binary);
+    if (!file)
+    {
+        std::cerr << "Failed to open " << path << "\n";
+        return false;
+    }
+
+    CompiledScene::Header header = {};
+    std::memcpy(header.magic, CompiledScene::MAGIC, sizeof(header.magic));
+    header.version = CompiledScene::VERSION;
+    header.real_size = sizeof(Real);
+    header.vec3_size = sizeof(Vec3);
+    header.material_size = sizeof(Material);
+    header.frames = description.frames;
+    header.builder = static_cast<uint32_t>(scene.builder);
+    header.vertical_fov = description.vertical_fov;
+
+    struct Block
+    {
+        uint64_t offset;
+        const void *data;
+        uint64_t size;
+    };
+    // Mesh sections are counted in elements of the concatenated arrays
+    std::vector<CompiledScene::MeshRecord> mesh_records;
+    std::vector<Vec3f> mesh_positions;
+    std::vector<uint32_t> mesh_indices;
+    std::vector<KDN> mesh_nodes;
+    for (const auto &record : description.meshes)
+    {
+        const MeshData &mesh = *record.mesh;
+        mesh_records.push_back({record.material, record.emissive, record.placed,
+                                {mesh_positions.size(), mesh.positions.size()},
+                                {mesh_indices.size(), mesh.indices.size()},
+                                {mesh_nodes.size(), mesh.nodes.size()}});
+        mesh_positions.insert(mesh_positions.end(), mesh.positions.begin(), mesh.positions.end());
+        mesh_indices.insert(mesh_indices.end(), mesh.indices.begin(), mesh.indices.end());
+        mesh_nodes.insert(mesh_nodes.end(), mesh.nodes.begin(), mesh.nodes.end());
+    }
+
+    std::vector<Block> blocks;
+    uint64_t offset = sizeof(header);
+    const auto add = [&](CompiledScene::Section &section, const auto &values) {
+        offset = (offset + CompiledScene::ALIGNMENT - 1) / CompiledScene::ALIGNMENT * CompiledScene::ALIGNMENT;
+        section = {offset, values.size()};
+        blocks.push_back({offset, values.data(), values.size() * sizeof(values[0])});
+        offset += blocks.back().size;
+    };
+    add(header.camera_keys, description.camera_keys);
+    add(header.materials, description.materials);
+    add(header.spheres, description.spheres);
+    add(header.boxes, description.boxes);
+    add(header.meshes, mesh_records);
+    add(header.mesh_positions, mesh_positions);
+    add(header.mesh_indices, mesh_indices);
+    add(header.mesh_nodes, mesh_nodes);
+    add(header.instances, description.instances);
+    add(header.nodes, scene.nodes());
+    add(header.primitive_indices, scene.primitiveIndices());
+
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    uint64_t position = sizeof(header);
+    const char padding[CompiledScene::ALIGNMENT] = {};
+    for (const Block &block : blocks)
+    {
+        file.write(padding, block.offset - position);
+        file.write(static_cast<const char*>(block.data), block.size);
+        position = block.offset + block.size;
+    }
+    return static_cast<bool>(file);
+}
+
+// Maps a compiled scene, fills `description` and sets up `scene` with the stored tree. The tree and
+// the meshes point into the mapping, which stays alive as long as they do.
+bool load_compiled_scene(const std::string &path, SceneDescription &description, KDTreeScene &scene)
+{
+    const auto file = std::make_shared<MappedFile>(path);
+    if (!file->valid() || file->size() < sizeof(CompiledScene::Header))
+    {
+        std::cerr << "Failed to map " << path << "\n";
+        return false;
+    }
+
+    CompiledScene::Header header;
+    std::memcpy(&header, file->data(), sizeof(header));
+    if (std::memcmp(header.magic, CompiledScene::MAGIC, sizeof(header.magic)) != 0
+        || header.version != CompiledScene::VERSION)
+    {
+        std::cerr << path << " is not a compiled scene of version " << CompiledScene::VERSION << "\n";
+        return false;
+    }
+    if (header.real_size != sizeof(Real) || header.vec3_size != sizeof(Vec3) || header.material_size != sizeof(Material))
+    {
+        std::cerr << path << " was compiled with a different Real or Vec3 configuration, compile it again\n";
+        return false;
+    }
+
+    bool valid = true;
+    const auto in_file = [&](const CompiledScene::Section &section, const size_t value_size) {
+        valid = valid && section.offset <= file->size() && section.count <= (file->size() - section.offset) / value_size;
+        return valid;
+    };
+    // Copies the description arrays, the entities are set up from them
+    const auto read = [&](const CompiledScene::Section &section, auto &values) {
+        using Value = typename std::decay_t<decltype(values)>::value_type;
+        if (in_file(section, sizeof(Value)))
+        {
+            const Value *first = reinterpret_cast<const Value*>(file->data() + section.offset);
+            values.assign(first, first + section.count);
+        }
+    };
+    // Points the tree and mesh arrays into the mapping, sections start at a cache line boundary
+    const auto map = [&](const CompiledScene::Section &section, auto &values) {
+        using Values = std::decay_t<decltype(values)>;
+        using Value = std::remove_reference_t<decltype(values[0])>;
+        if (in_file(section, sizeof(Value)))
+        {
+            values = Values(file, reinterpret_cast<Value*>(file->data() + section.offset), section.count);
+        }
+    };
+    SharedArray<KDN> nodes;
+    SharedArray<uint32_t> primitive_indices;
+    std::vector<CompiledScene::MeshRecord> mesh_records;
+    SharedArray<Vec3f> mesh_positions;
+    SharedArray<uint32_t> mesh_indices;
+    SharedArray<KDN> mesh_nodes;
+    read(header.camera_keys, description.camera_keys);
+    read(header.materials, description.materials);
+    read(header.spheres, description.spheres);
+    read(header.boxes, description.boxes);
+    read(header.meshes, mesh_records);
+    map(header.mesh_positions, mesh_positions);
+    map(header.mesh_indices, mesh_indices);
+    map(header.mesh_nodes, mesh_nodes);
+    read(header.instances, description.instances);
+    map(header.nodes, nodes);
+    map(header.primitive_indices, primitive_indices);
+    if (!valid)
+    {
+        std::cerr << path << " is truncated\n";
+        return false;
+    }
+    const auto known_material = [&](const auto &record) { return record.material < description.materials.size(); };
+    if (!std::all_of(description.spheres.begin(), description.spheres.end(), known_material)
+        || !std::all_of(description.boxes.begin(), description.boxes.end(), known_material)
+        || !std::all_of(mesh_records.begin(), mesh_records.end(), known_material))
+    {
+        std::cerr << path << " references materials it does not contain\n";
+        return false;
+    }
+    if (!std::all_of(description.materials.begin(), description.materials.end(), [](const Material &material) {
+            return static_cast<uint32_t>(material.type) <= static_cast<uint32_t>(MaterialType::PHYSICS);
+        }))
+    {
+        std::cerr << path << " holds materials of an unknown type\n";
+        return false;
+    }
+
+    const auto slice = [](const CompiledScene::Section &section, const auto &values, auto &out) {
+        if (section.offset > values.size() || section.count > values.size() - section.offset)
+        {
+            return false;
+        }
+        out = values.slice(section.offset, section.count);
+        return true;
+    };
+    description.meshes.clear();
+    for (const auto &record : mesh_records)
+    {
+        auto mesh = std::make_shared<MeshData>();
+        if (!slice(record.positions, mesh_positions, mesh->positions) || !slice(record.indices, mesh_indices, mesh->indices)
+            || !slice(record.nodes, mesh_nodes, mesh->nodes) || !mesh->valid())
+        {
+            std::cerr << path << " holds an invalid mesh\n";
+            return false;
+        }
+        const KDN &root = mesh->nodes.front();
+        mesh->bounds = {Vec3(root.low[0], root.low[1], root.low[2]), Vec3(root.high[0], root.high[1], root.high[2])};
+        description.addMesh(std::move(mesh), record.material, record.emissive, record.placed);
+    }
+    if (!std::all_of(description.instances.begin(), description.instances.end(), [&](const auto &instance) {
+            return instance.mesh < description.meshes.size();
+        }))
+    {
+        std::cerr << path << " holds instances of meshes it does not contain\n";
+        return false;
+    }
+    description.frames = header.frames;
+    description.vertical_fov = header.vertical_fov;
+
+    description.populate(scene);
+    scene.builder = static_cast<TreeBuilder>(header.builder);
+    if (!scene.setTree(std::move(nodes), std::move(primitive_indices)))
+    {
+        std::cerr << path << " holds a tree that does not match its primitives\n";
+        return false;
+    }
+    return true;
+}
+
+// Loads a compiled scene if the path ends in .rtscene, otherwise parses the text format and builds the tree
+bool load_scene(const std::string &path, SceneDescription &description, KDTreeScene &scene)
+{
+    const std::string extension = ".rtscene";
+    if (path.size() >= extension.size() && path.compare(path.size() - extension.size(), extension.size(), extension) == 0)
+    {
+        return load_compiled_scene(path, description, scene);
+    }
+    if (!parse_scene(path, description))
+    {
+        return false;
+    }
+    description.populate(scene);
+    scene.update();
+    return true;
+}
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include <tbb/parallel_for.h>
+
+#include "image.hpp"
+#include "pixel-estimate.hpp"
+#include "vec3.hpp"
+
+// Edge avoiding a-trous wavelet filter (Dammertz et al. 2010) with the variance guided color
+// weight of SVGF (Schied et al. 2017). Every pass blurs with a 5x5 B3 spline kernel whose taps are
+// 2^pass pixels apart, so five passes reach 31 pixels out at 25 taps per pixel each. Taps get
+// little weight across edges in depth, normal or albedo, or when their luminance differs by more
+// than the pixel's noise explains, so converged pixels keep their detail.
+class Denoiser
+{
+    public:
+        explicit Denoiser(const int passes = 5);
+
+        // Filters the colors of `image` in place, before tone mapping
+        void apply(Image &image) const;
+
+        // Luminance differences are measured in standard deviations of the pixel's noise
+        static constexpr double COLOR_SIGMA = 2.0;
+        // The cosine between normals is raised to 2^NORMAL_SQUARINGS (128)
+        static constexpr int NORMAL_SQUARINGS = 7;
+        // Relative depth difference allowed per pixel of tap distance
+        static constexpr double DEPTH_SIGMA = 0.02;
+        static constexpr double ALBEDO_SIGMA = 0.1;
+
+    private:
+        // Variance blurred over the 3x3 neighbourhood, the estimates of single pixels are too noisy
+        // at low sample counts to steer the weights
+        static double smoothVariance(const std::vector<double> &variances, const int width, const int height, const int x,
+                                     const int y);
+
+        int passes_;
+};
+
+Denoiser::Denoiser(const int passes)
+    : passes_(passes)
+{
+}
+
+double Denoiser::smoothVariance(const std::vector<double> &variances, const int width, const int height, const int x,
+                                const int y)
+{
+    static constexpr double KERNEL[2] = {1.0 / 2.0, 1.0 / 4.0};
+    double sum = 0.0;
+    double weight_sum = 0.0;
+    for (int dy = -1; dy <= 1; ++dy)
+    {
+        for (int dx = -1; dx <= 1; ++dx)
+        {
+            const int qx = x + dx;
+            const int qy = y + dy;
+            if (qx >= 0 && qx < width && qy >= 0 && qy < height)
+            {
+                const double weight = KERNEL[std::abs(dx)] * KERNEL[std::abs(dy)];
+                sum += weight * variances[qy * width + qx];
+                weight_sum += weight;
+            }
+        }
+    }
+    return sum / weight_sum;
+}
+
+void Denoiser::apply(Image &image) const
+{
+    static constexpr double KERNEL[3] = {3.0 / 8.0, 1.0 / 4.0, 1.0 / 16.0};
+    const int width = image.width();
+    const int height = image.height();
+    const std::vector<Pixel> &pixels = image.pixels;
+
+    // The guides are copied out of the pixels so the taps read compact arrays
+    std::vector<Vec3d> colors(pixels.size());
+    std::vector<double> variances(pixels.size());
+    std::vector<double> depths(pixels.size());
+    std::vector<Vec3d> albedos(pixels.size());
+    // Averaged normals are shorter than one where samples hit different surfaces, misses have none
+    std::vector<Vec3d> normals(pixels.size());
+    tbb::parallel_for(size_t(0), pixels.size(), [&](const size_t i) {
+        colors[i] = pixels[i].color;
+        variances[i] = pixels[i].variance;
+        depths[i] = pixels[i].depth;
+        albedos[i] = pixels[i].albedo;
+        if (pixels[i].normal.squaredLength() > 0.0)
+        {
+            normals[i] = pixels[i].normal.normalized();
+        }
+    });
+    std::vector<double> luminances(pixels.size());
+    std::vector<Vec3d> filtered_colors(pixels.size());
+    std::vector<double> filtered_variances(pixels.size());
+
+    for (int pass = 0; pass < passes_; ++pass)
+    {
+        const int step = 1 << pass;
+        tbb::parallel_for(size_t(0), pixels.size(), [&](const size_t i) {
+            luminances[i] = luminance(colors[i]);
+        });
+        // Per tap offset, zero for the center tap whose depth always matches
+        double inverse_distances[5][5];
+        for (int dy = -2; dy <= 2; ++dy)
+        {
+            for (int dx = -2; dx <= 2; ++dx)
+            {
+                inverse_distances[dy + 2][dx + 2] = dx == 0 && dy == 0
+                    ? 0.0 : 1.0 / (step * std::sqrt(static_cast<double>(dx * dx + dy * dy)));
+            }
+        }
+        tbb::parallel_for(0, height, [&](const int y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                const int p = y * width + x;
+
+                const double variance = smoothVariance(variances, width, height, x, y);
+                const double color_scale = 1.0 / (COLOR_SIGMA * std::sqrt(std::max(variance, 0.0)) + 1e-6);
+                const double depth_scale = 1.0 / (DEPTH_SIGMA * depths[p] + 1e-6);
+                const bool center_hit = normals[p].squaredLength() > 0.0;
+
+                Vec3d color_sum;
+                double weight_sum = 0.0;
+                double variance_sum = 0.0;
+                for (int dy = -2; dy <= 2; ++dy)
+                {
+                    const int qy = y + dy * step;
+                    if (qy < 0 || qy >= height)
+                    {
+                        continue;
+                    }
+                    for (int dx = -2; dx <= 2; ++dx)
+                    {
+                        const int qx = x + dx * step;
+                        if (qx < 0 || qx >= width)
+                        {
+                            continue;
+                        }
+                        const int q = qy * width + qx;
+
+                        // Hits only blend with hits, misses with misses
+                        if (center_hit != (normals[q].squaredLength() > 0.0))
+                        {
+                            continue;
+                        }
+                        double normal_weight = 1.0;
+                        if (center_hit)
+                        {
+                            normal_weight = std::max(0.0, normals[p].dot(normals[q]));
+                            for (int i = 0; i < NORMAL_SQUARINGS; ++i)
+                            {
+                                normal_weight *= normal_weight;
+                            }
+                        }
+                        // The depth, albedo and color weights are exponentials and share a single exp()
+                        const double depth_term = std::abs(depths[p] - depths[q]) * depth_scale
+                            * inverse_distances[dy + 2][dx + 2];
+                        const double albedo_term = (albedos[p] - albedos[q]).squaredLength() / (ALBEDO_SIGMA * ALBEDO_SIGMA);
+                        const double color_term = std::abs(luminances[p] - luminances[q]) * color_scale;
+
+                        const double weight = KERNEL[std::abs(dx)] * KERNEL[std::abs(dy)] * normal_weight
+                            * std::exp(-(depth_term + albedo_term + color_term));
+                        color_sum += colors[q] * weight;
+                        weight_sum += weight;
+                        variance_sum += weight * weight * variances[q];
+                    }
+                }
+                // The center tap always has a weight, so weight_sum is positive
+                filtered_colors[p] = color_sum / weight_sum;
+                filtered_variances[p] = variance_sum / (weight_sum * weight_sum);
+            }
+        });
+        std::swap(colors, filtered_colors);
+        std::swap(variances, filtered_variances);
+    }
+
+    tbb::parallel_for(size_t(0), pixels.size(), [&](const size_t i) {
+        image.pixels[i].color = colors[i];
+    });
+}
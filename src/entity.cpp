@@ -1,3 +1,5 @@
+#include <limits>
+
 #include "entity.hpp"
 
 void AABB::expand(const AABB &box)
@@ -9,67 +11,71 @@ void AABB::expand(const AABB &box)
     }
 }
 
-bool AABB::intersect(const Ray &r) const
+void AABB::expand(const Vec3 &point)
 {
-    double tmin, tmax, tymin, tymax, tzmin, tzmax;
-    int r_sign[3];
-    Vec3 r_invdir = 1.0f / r.direction();
-
-    for (int i = 0; i < 3; ++i)
+    for (int i = 0; i<3; i++)
     {
-        r_sign[i] = r_invdir[i] < 0 ? 1 : 0;
+        low[i] = std::min(low[i], point[i]);
+        high[i] = std::max(high[i], point[i]);
     }
+}
 
-    Vec3 bounds[2] = {low,high};
-
-    tmin = (bounds[r_sign[0]].x() - r.origin().x()) * r_invdir.x();
-    tmax = (bounds[1 - r_sign[0]].x() - r.origin().x()) * r_invdir.x();
-    tymin = (bounds[r_sign[1]].y() - r.origin().y()) * r_invdir.y();
-    tymax = (bounds[1 - r_sign[1]].y() - r.origin().y()) * r_invdir.y();
-
-    if ((tmin > tymax) || (tymin > tmax))
-        return false;
-
-    if (tymin > tmin)
-        tmin = tymin;
-    if (tymax < tmax)
-        tmax = tymax;
-
-    tzmin = (bounds[r_sign[2]].z() - r.origin().z()) * r_invdir.z();
-    tzmax = (bounds[1 - r_sign[2]].z() - r.origin().z()) * r_invdir.z();
-
-    if ((tmin > tzmax) || (tzmin > tmax))
-        return false;
+double AABB::surfaceArea() const
+{
+    const Vec3 size = high - low;
+    if (size[0] < 0 || size[1] < 0 || size[2] < 0)
+    {
+        return 0.0;
+    }
+    return 2.0 * (size[0] * size[1] + size[1] * size[2] + size[2] * size[0]);
+}
 
-    if (tzmin > tmin)
-        tmin = tzmin;
-    if (tzmax < tmax)
-        tmax = tzmax;
+AABB AABB::empty()
+{
+    const Real inf = std::numeric_limits<Real>::infinity();
+    return {Vec3(inf), Vec3(-inf)};
+}
 
-    double t = tmin;
+bool AABB::intersect(const TraversalRay &ray) const
+{
+    Real t_enter, t_exit;
+    slab_test(ray, low, high, t_enter, t_exit);
+    return std::max(t_enter, ray.t_min) <= std::min(t_exit, ray.t_max);
+}
 
-    if (t < 0)
+bool Entity::hit(const Ray &r, const Real t_min, const Real t_max, HitData &data) const
+{
+    data.t = t_max;
+    if (!intersect(TraversalRay(r, t_min, t_max), data))
     {
-        t = tmax;
-        if (t < 0)
-            return false;
+        return false;
     }
+    data.entity->interact(r, data);
     return true;
-    // const Vec3 inverse_direction = 1.0f / r.direction();
-    // double t0 = (low[0] - r.origin()[0] * inverse_direction[0]);
-    // double t1 = (high[0] - r.origin()[0] * inverse_direction[0]);
-
-    // double tmin = std::min(t0, t1);
-    // double tmax = std::max(t0, t1);
+}
 
-    // for (int i = 1; i < 3; ++i)
-    // {
-    //     t0 = (low[i] - r.origin()[i]) * inverse_direction[i];
-    //     t1 = (high[i] - r.origin()[i]) * inverse_direction[i];
+bool Entity::occluded(const Ray &r, const Real t_min, const Real t_max) const
+{
+    return occludes(TraversalRay(r, t_min, t_max));
+}
 
-    //     tmin = std::max(tmin, std::min(t0, t1));
-    //     tmax = std::min(tmax, std::max(t0, t1));
-    // }
+bool Entity::occludes(const TraversalRay &ray) const
+{
+    HitData data;
+    return intersect(ray, data);
+}
 
-    // return tmax > std::max(tmin, 0.0);
-}
\ No newline at end of file
+PacketMask Entity::hitPacket(const RayPacket &packet, const PacketMask &active, const Real t_min,
+                             PacketReal &closest, HitPacket &data) const
+{
+    PacketMask hits = {};
+    for (int lane = 0; lane < PACKET_SIZE; ++lane)
+    {
+        if (active[lane] && intersect(TraversalRay(packet.rays[lane], t_min, closest[lane]), data[lane]))
+        {
+            closest[lane] = data[lane].t;
+            hits[lane] = -1;
+        }
+    }
+    return hits;
+}
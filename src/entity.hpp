@@ -1,38 +1,77 @@
 #pragma once
 
-#include <memory>
+#include <array>
+#include <cstdint>
 
 #include "ray.hpp"
+#include "ray-packet.hpp"
 
-class Material;
 class Entity;
 
+// Index into Scene::materials
+using MaterialId = uint32_t;
+
+// Instances of instances may be nested this deep
+constexpr int MAX_INSTANCE_DEPTH = 4;
+
+// Intersection only records `t` and the entity hit. The surface data below is filled in
+// by Entity::interact() once the closest hit is known.
 struct HitData
 {
-    double t;
+    Real t;
     Vec3 hit_point;
     Vec3 normal;
     Vec3 debugColor;
     int debugCounter;
     int debugStep;
     bool debug = false;
-    std::shared_ptr<const Material> material;
-    std::shared_ptr<const Entity> entity;
+    MaterialId material = 0;
+    // Non-owning, the scene keeps its entities alive
+    const Entity *entity = nullptr;
+    // Part of the entity that was hit and where, for entities made of several primitives
+    uint32_t primitive = 0;
+    Real u = 0;
+    Real v = 0;
+    // For hits inside instances `entity` is the outermost instance. These are the entities hit
+    // within it, the innermost first, each in the object space of the next.
+    std::array<const Entity*, MAX_INSTANCE_DEPTH> instanced;
+    int instanceDepth = 0;
 };
 
+using HitPacket = std::array<HitData, PACKET_SIZE>;
+
 struct AABB
 {
     Vec3 low;
     Vec3 high;
     void expand(const AABB &box);
-    bool intersect(const Ray &r) const;
+    void expand(const Vec3 &point);
+    double surfaceArea() const;
+    bool intersect(const TraversalRay &ray) const;
+    static AABB empty();
 };
 
-class Entity: public std::enable_shared_from_this<Entity>
+class Entity
 {
     public:
         virtual void update() = 0;
-        virtual bool hit(const Ray &r, const double t_min, const double t_max, HitData &data) const = 0;
+        // Finds the closest hit within [t_min, t_max] and its surface data, data.t is t_max if there is none
+        bool hit(const Ray &r, const Real t_min, const Real t_max, HitData &data) const;
+        // Finds the closest hit within [ray.t_min, ray.t_max], recording only data.t and data.entity
+        virtual bool intersect(const TraversalRay &ray, HitData &data) const = 0;
+        // Fills in hit point, normal and material for a hit on this entity at data.t
+        virtual void interact(const Ray &r, HitData &data) const {}
+        // The material of the whole surface, false if the entity does not have a single one
+        virtual bool surfaceMaterial(MaterialId &material) const { return false; }
+        // True if anything is hit within [t_min, t_max], returns on the first hit found
+        bool occluded(const Ray &r, const Real t_min, const Real t_max) const;
+        // Any-hit test within [ray.t_min, ray.t_max]. Defaults to a full intersection,
+        // primitives override it with tests that skip the hit record.
+        virtual bool occludes(const TraversalRay &ray) const;
+        // Intersects the active lanes of a packet. Lanes that find a hit closer than `closest`
+        // update it and record the hit like intersect(), the returned mask marks them.
+        virtual PacketMask hitPacket(const RayPacket &packet, const PacketMask &active, const Real t_min,
+                                     PacketReal &closest, HitPacket &data) const;
         AABB boundingBox;
         Vec3 transform;
         bool emissive = false;
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Encodes finished frames on background threads so the next frame can render meanwhile.
+// At most `queue_depth` frames are pending at once, which caps the memory held by queued images.
+class FrameWriter
+{
+    public:
+        FrameWriter(const size_t queue_depth, const int encoder_threads);
+        ~FrameWriter();
+
+        // Queues `encode` for a background thread. Blocks while queue_depth frames are pending.
+        void submit(const std::string &name, std::function<bool()> encode);
+        // Waits until every queued frame has been written
+        void finish();
+
+    private:
+        struct Job
+        {
+            std::string name;
+            std::function<bool()> encode;
+        };
+
+        void run();
+
+        const size_t queueDepth_;
+        std::deque<Job> queue_;
+        size_t pending_ = 0;
+        bool stop_ = false;
+        int frames_ = 0;
+        double encodeSeconds_ = 0.0;
+
+        std::mutex mutex_;
+        std::condition_variable jobAvailable_;
+        std::condition_variable jobDone_;
+        std::vector<std::thread> threads_;
+};
+
+FrameWriter::FrameWriter(const size_t queue_depth, const int encoder_threads)
+    : queueDepth_(queue_depth)
+{
+    for (int i = 0; i < encoder_threads; ++i)
+    {
+        threads_.emplace_back([this] { run(); });
+    }
+}
+
+FrameWriter::~FrameWriter()
+{
+    finish();
+}
+
+void FrameWriter::submit(const std::string &name, std::function<bool()> encode)
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    jobDone_.wait(lock, [this] { return pending_ < queueDepth_; });
+    pending_++;
+    queue_.push_back({name, std::move(encode)});
+    jobAvailable_.notify_one();
+}
+
+void FrameWriter::finish()
+{
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (stop_)
+        {
+            return;
+        }
+        jobDone_.wait(lock, [this] { return pending_ == 0; });
+        stop_ = true;
+    }
+    jobAvailable_.notify_all();
+    for (auto &thread : threads_)
+    {
+        thread.join();
+    }
+
+    if (frames_ > 0)
+    {
+        std::cout << "Encoded " << frames_ << " frames in " << encodeSeconds_ << "s, "
+                  << encodeSeconds_ / frames_ << "s per frame\n";
+    }
+}
+
+void FrameWriter::run()
+{
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true)
+    {
+        jobAvailable_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+        if (queue_.empty())
+        {
+            return;
+        }
+        Job job = std::move(queue_.front());
+        queue_.pop_front();
+        lock.unlock();
+
+        const auto start_time = std::chrono::steady_clock::now();
+        const bool written = job.encode();
+        const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+        if (!written)
+        {
+            std::cerr << "Failed to write " << job.name << "\n";
+        }
+        // Release the frame before allowing the next one in
+        job.encode = nullptr;
+
+        lock.lock();
+        std::cout << "Encoded " << job.name << " in " << seconds << "s\n";
+        frames_++;
+        encodeSeconds_ += seconds;
+        pending_--;
+        jobDone_.notify_all();
+    }
+}
@@ -13,9 +13,14 @@
 
 struct Pixel
 {
-    Vec3 color;
+    Vec3d color;
     double depth;
+    // First hit normal and albedo and the variance of the color's luminance, guiding the denoiser
+    Vec3d normal;
+    Vec3d albedo;
+    double variance;
     int debug_counter;
+    int samples;
     std::chrono::steady_clock::duration time;
 };
 
@@ -52,16 +57,26 @@ void Image::set_dimensions(const int new_width, const int new_height)
     pixels.resize(_width * _height);
 }
 
-inline Vec3 tone_map(const Vec3 &color, const double exposure)
+int Image::width() const
 {
-    return Vec3(1.0f - exp(-color[0] * exposure),
+    return _width;
+}
+
+int Image::height() const
+{
+    return _height;
+}
+
+inline Vec3d tone_map(const Vec3d &color, const double exposure)
+{
+    return Vec3d(1.0f - exp(-color[0] * exposure),
                 1.0f - exp(-color[1] * exposure),
                 1.0f - exp(-color[2] * exposure));
 }
 
-inline Vec3 gamma_correct(const Vec3 &color, const double gamma)
+inline Vec3d gamma_correct(const Vec3d &color, const double gamma)
 {
-    return Vec3(pow(color[0], 1.0f / gamma),
+    return Vec3d(pow(color[0], 1.0f / gamma),
                 pow(color[1], 1.0f / gamma),
                 pow(color[2], 1.0f / gamma));
 }
@@ -70,7 +85,7 @@ void Image::post_process(const double exposure, const double gamma)
 {
     std::for_each(std::execution::par_unseq, pixels.begin(), pixels.end(), [&](Pixel &pixel)
     {
-        Vec3 c = pixel.color;
+        Vec3d c = pixel.color;
 
         c = tone_map(c, exposure);
         c = gamma_correct(c, gamma);
@@ -85,7 +100,7 @@ bool Image::write_color_image(const std::string filepath) const
     pixels_8bit.resize(_width * _height);
     std::transform(std::execution::par_unseq, pixels.begin(), pixels.end(), pixels_8bit.begin(), [&](const Pixel &pixel)
     {
-        Vec3 c = pixel.color * 255.99f;
+        Vec3d c = pixel.color * 255.99f;
         return std::make_tuple(unit8_clamp(c[2]), unit8_clamp(c[1]), unit8_clamp(c[0]));
     });
     return stbi_write_png(filepath.c_str(), _width, _height, 3, pixels_8bit.data(), _width * 3);
@@ -127,7 +142,7 @@ bool Image::write_transform_image(const std::string filepath, std::function<doub
     std::transform(std::execution::par_unseq, pixels.begin(), pixels.end(), pixels_8bit.begin(), [&](const Pixel &pixel)
     {
         const double duration = (transform(pixel) - base) / range;
-        Vec3 c = Vec3(unit8_clamp(duration * 255.99));
+        Vec3d c = Vec3d(unit8_clamp(duration * 255.99));
         return std::make_tuple(c[2], c[1], c[0]);
     });
     return stbi_write_png(filepath.c_str(), _width, _height, 3, pixels_8bit.data(), _width * 3);
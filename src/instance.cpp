@@ -0,0 +1,89 @@
+#include "instance.hpp"
+
+void Instance::update()
+{
+    const Transform to_world = toObject.inverse();
+    boundingBox = to_world.bounds(object->boundingBox);
+    transform = to_world.point(object->transform);
+}
+
+bool Instance::record(const HitData& local, HitData& data) const
+{
+    if (local.instanceDepth >= MAX_INSTANCE_DEPTH)
+    {
+        return false;
+    }
+    data.t = local.t;
+    data.entity = this;
+    data.primitive = local.primitive;
+    data.u = local.u;
+    data.v = local.v;
+    data.instanced = local.instanced;
+    data.instanceDepth = local.instanceDepth;
+    data.instanced[data.instanceDepth++] = local.entity;
+    return true;
+}
+
+bool Instance::intersect(const TraversalRay& ray, HitData& data) const
+{
+    HitData local;
+    const TraversalRay local_ray(toObject.ray(ray.ray), ray.t_min, ray.t_max);
+    return object->intersect(local_ray, local) && record(local, data);
+}
+
+bool Instance::occludes(const TraversalRay& ray) const
+{
+    return object->occludes(TraversalRay(toObject.ray(ray.ray), ray.t_min, ray.t_max));
+}
+
+PacketMask Instance::hitPacket(const RayPacket& packet, const PacketMask& active, const Real t_min,
+                               PacketReal& closest, HitPacket& data) const
+{
+    std::array<Ray, PACKET_SIZE> rays;
+    for (int lane = 0; lane < PACKET_SIZE; ++lane)
+    {
+        rays[lane] = toObject.ray(packet.rays[lane]);
+    }
+    const RayPacket local_packet(rays.data(), PACKET_SIZE);
+    PacketReal local_closest = closest;
+    HitPacket local;
+    PacketMask hits = object->hitPacket(local_packet, active, t_min, local_closest, local);
+    for (int lane = 0; lane < PACKET_SIZE; ++lane)
+    {
+        if (hits[lane] && record(local[lane], data[lane]))
+        {
+            closest[lane] = local_closest[lane];
+        }
+        else
+        {
+            hits[lane] = 0;
+        }
+    }
+    return hits;
+}
+
+void Instance::interact(const Ray& r, HitData& data) const
+{
+    // The hit distance is the same in object space since the direction is not normalized
+    const Entity *hit = data.instanced[--data.instanceDepth];
+    hit->interact(toObject.ray(r), data);
+    data.hit_point = r.pointAt(data.t);
+    // Normals transform with the transposed inverse
+    const Vec3 normal = data.normal;
+    data.normal = Vec3(toObject.m[0][0] * normal[0] + toObject.m[1][0] * normal[1] + toObject.m[2][0] * normal[2],
+                       toObject.m[0][1] * normal[0] + toObject.m[1][1] * normal[1] + toObject.m[2][1] * normal[2],
+                       toObject.m[0][2] * normal[0] + toObject.m[1][2] * normal[1] + toObject.m[2][2] * normal[2])
+                      .normalized();
+    data.material += materialOffset;
+    data.entity = this;
+}
+
+bool Instance::surfaceMaterial(MaterialId& material) const
+{
+    if (!object->surfaceMaterial(material))
+    {
+        return false;
+    }
+    material += materialOffset;
+    return true;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <memory>
+#include <utility>
+
+#include "entity.hpp"
+#include "transform.hpp"
+
+// Places shared geometry, a primitive, a mesh or a whole scene, into the world through an affine
+// transform. Rays are taken into object space for the intersection, so any number of instances
+// cost one copy of the object. The object must be updated before instances of it are created.
+// Shading looks materials up in the table of the scene the instance is placed in. An object with
+// a table of its own, such as a whole scene, needs that table appended to the placing scene's and
+// the index of its first material passed as `material_offset`, which shifts the object's IDs.
+class Instance : public Entity
+{
+  public:
+    Instance(std::shared_ptr<const Entity> object, const Transform &to_world, const MaterialId material_offset = 0)
+        : object(std::move(object))
+        , toObject(to_world.inverse())
+        , materialOffset(material_offset)
+    {
+        Instance::update();
+    }
+    void update() override;
+    bool intersect(const TraversalRay& ray, HitData& data) const override;
+    bool occludes(const TraversalRay& ray) const override;
+    void interact(const Ray& r, HitData& data) const override;
+    bool surfaceMaterial(MaterialId& material) const override;
+    PacketMask hitPacket(const RayPacket& packet, const PacketMask& active, const Real t_min,
+                         PacketReal& closest, HitPacket& data) const override;
+    std::shared_ptr<const Entity> object;
+    // Only the world to object transform is kept, instances are meant to be many and small
+    Transform toObject;
+    MaterialId materialOffset;
+
+  private:
+    // Takes over a hit found in object space, returns false if nesting is too deep to record it
+    bool record(const HitData& local, HitData& data) const;
+};
@@ -0,0 +1,349 @@
+#include <algorithm>
+#include <array>
+#include <numeric>
+
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_invoke.h>
+
+#include "kdtree-builder.hpp"
+
+std::ostream& operator<<(std::ostream &os, const TreeStats &stats)
+{
+    os << (stats.builder == TreeBuilder::SAH ? "SAH" : "midpoint") << " tree: "
+       << stats.nodes << " nodes, " << stats.leaves << " leaves, depth " << stats.max_depth
+       << ", " << stats.average_leaf_size << " entities/leaf, SAH cost " << stats.sah_cost
+       << ", built in " << stats.build_seconds * 1000.0 << "ms";
+    return os;
+}
+
+KDTreeBuilder::KDTreeBuilder(const std::vector<std::shared_ptr<Entity>> &entities,
+                             std::vector<KDN> &nodes, std::vector<uint32_t> &primitive_indices)
+    : nodes_(nodes)
+    , primitiveIndices_(primitive_indices)
+    , primitives_(entities.size())
+    , batchSize_(PACKET_SIZE)
+    , batchCost_(BATCH_INTERSECTION_COST)
+    , nodeCount_(0)
+{
+    tbb::parallel_for(size_t(0), entities.size(), [&](const size_t i) {
+        primitives_[i] = {entities[i]->boundingBox, entities[i]->transform};
+    });
+}
+
+KDTreeBuilder::KDTreeBuilder(const std::vector<AABB> &bounds, std::vector<KDN> &nodes,
+                             std::vector<uint32_t> &primitive_indices, const uint32_t batch_size, const double batch_cost)
+    : nodes_(nodes)
+    , primitiveIndices_(primitive_indices)
+    , primitives_(bounds.size())
+    , batchSize_(batch_size)
+    , batchCost_(batch_cost)
+    , nodeCount_(0)
+{
+    tbb::parallel_for(size_t(0), bounds.size(), [&](const size_t i) {
+        primitives_[i] = {bounds[i], (bounds[i].low + bounds[i].high) / 2.0};
+    });
+}
+
+void KDTreeBuilder::build(const TreeBuilder builder)
+{
+    const uint32_t size = primitives_.size();
+    primitiveIndices_.resize(size);
+    std::iota(primitiveIndices_.begin(), primitiveIndices_.end(), 0);
+    nodes_.clear();
+    if (size == 0)
+    {
+        return;
+    }
+
+    // Both builders only ever create non-empty children, so 2n - 1 nodes always suffice
+    nodes_.resize(2 * size - 1);
+    nodeCount_ = 1;
+    if (builder == TreeBuilder::SAH)
+    {
+        buildSAH(0, 0, size, 0);
+    }
+    else
+    {
+        buildMidpoint(0, 0, size, 0);
+    }
+    nodes_.resize(nodeCount_);
+    primitives_.clear();
+    primitives_.shrink_to_fit();
+}
+
+TreeStats KDTreeBuilder::stats(const TreeBuilder builder) const
+{
+    return stats(builder, nodes_.data(), nodes_.size(), batchSize_, batchCost_);
+}
+
+TreeStats KDTreeBuilder::stats(const TreeBuilder builder, const KDN *nodes, const size_t node_count,
+                               const uint32_t batch_size, const double batch_cost)
+{
+    TreeStats stats;
+    stats.builder = builder;
+    stats.nodes = node_count;
+    if (node_count == 0)
+    {
+        return stats;
+    }
+
+    const double root_area = std::max(nodes[0].surfaceArea(), std::numeric_limits<double>::min());
+
+    size_t leaf_entities = 0;
+    std::vector<std::pair<uint32_t, int>> stack = {{0, 0}};
+    while (!stack.empty())
+    {
+        const auto [index, depth] = stack.back();
+        stack.pop_back();
+        const KDN &node = nodes[index];
+        const double relative_area = node.surfaceArea() / root_area;
+        stats.max_depth = std::max(stats.max_depth, depth);
+        if (node.isLeaf())
+        {
+            stats.leaves++;
+            leaf_entities += node.count;
+            stats.sah_cost += relative_area * intersectionCost(node.count, batch_size, batch_cost);
+            continue;
+        }
+        stats.sah_cost += relative_area * TRAVERSAL_COST;
+        stack.emplace_back(node.offset, depth + 1);
+        stack.emplace_back(node.offset + 1, depth + 1);
+    }
+    stats.average_leaf_size = static_cast<double>(leaf_entities) / stats.leaves;
+    return stats;
+}
+
+AABB KDTreeBuilder::bounds(const uint32_t begin, const uint32_t end) const
+{
+    AABB box = AABB::empty();
+    for (uint32_t i = begin; i < end; ++i)
+    {
+        box.expand(primitives_[primitiveIndices_[i]].bounds);
+    }
+    return box;
+}
+
+AABB KDTreeBuilder::centerBounds(const uint32_t begin, const uint32_t end) const
+{
+    AABB box = AABB::empty();
+    for (uint32_t i = begin; i < end; ++i)
+    {
+        box.expand(primitives_[primitiveIndices_[i]].center);
+    }
+    return box;
+}
+
+void KDTreeBuilder::setBounds(const uint32_t node_index, const AABB &box)
+{
+    KDN &node = nodes_[node_index];
+    for (int i = 0; i < 3; ++i)
+    {
+        node.low[i] = round_down(box.low[i]);
+        node.high[i] = round_up(box.high[i]);
+    }
+}
+
+void KDTreeBuilder::setLeaf(const uint32_t node_index, const uint32_t begin, const uint32_t end)
+{
+    KDN &node = nodes_[node_index];
+    node.offset = begin;
+    node.count = end - begin;
+    node.axis = 0;
+}
+
+uint64_t KDTreeBuilder::depthCapacity(const int depth)
+{
+    const int levels = MAX_DEPTH - 1 - depth;
+    return levels >= 32 ? std::numeric_limits<uint64_t>::max() : static_cast<uint64_t>(MAX_LEAF_SIZE) << levels;
+}
+
+void KDTreeBuilder::buildChildren(const uint32_t node_index, const uint32_t begin, uint32_t middle,
+                                  const uint32_t end, const int depth, const int axis, const TreeBuilder builder)
+{
+    // Splits too lopsided for the depth left halve the range instead, so no subtree outgrows it
+    if (std::max(middle - begin, end - middle) > depthCapacity(depth + 1))
+    {
+        middle = begin + (end - begin) / 2;
+    }
+
+    const uint32_t first_child = nodeCount_.fetch_add(2);
+    KDN &node = nodes_[node_index];
+    node.offset = first_child;
+    node.count = 0;
+    node.axis = axis;
+
+    const auto build_child = [&](const uint32_t child, const uint32_t child_begin, const uint32_t child_end) {
+        if (builder == TreeBuilder::SAH)
+        {
+            buildSAH(child, child_begin, child_end, depth + 1);
+        }
+        else
+        {
+            buildMidpoint(child, child_begin, child_end, depth + 1);
+        }
+    };
+
+    if (end - begin > PARALLEL_THRESHOLD)
+    {
+        tbb::parallel_invoke([&] { build_child(first_child, begin, middle); },
+                             [&] { build_child(first_child + 1, middle, end); });
+    }
+    else
+    {
+        build_child(first_child, begin, middle);
+        build_child(first_child + 1, middle, end);
+    }
+}
+
+void KDTreeBuilder::buildMidpoint(const uint32_t node_index, const uint32_t begin, const uint32_t end, const int depth)
+{
+    const uint32_t size = end - begin;
+    const AABB box = bounds(begin, end);
+    setBounds(node_index, box);
+
+    if (size <= 4 || depth >= MAX_DEPTH - 1 || (depth > 8 && size <= MAX_LEAF_SIZE))
+    {
+        setLeaf(node_index, begin, end);
+        return;
+    }
+
+    Vec3 averagePosition(0.0f);
+    for (uint32_t i = begin; i < end; ++i)
+    {
+        averagePosition += primitives_[primitiveIndices_[i]].center;
+    }
+    averagePosition /= size;
+
+    // Find largest bounding box dimension
+    const Vec3 boundingBoxSize = box.high - box.low;
+    int splitAxis;
+    if (boundingBoxSize[0] >= boundingBoxSize[1] && boundingBoxSize[0] >= boundingBoxSize[2])
+    {
+        splitAxis = 0;
+    }
+    else
+    {
+        splitAxis = boundingBoxSize[1] >= boundingBoxSize[2] ? 1 : 2;
+    }
+
+    auto first = primitiveIndices_.begin() + begin;
+    auto last = primitiveIndices_.begin() + end;
+    uint32_t middle = std::partition(first, last, [&](const uint32_t index) {
+        return primitives_[index].center[splitAxis] < averagePosition[splitAxis];
+    }) - primitiveIndices_.begin();
+
+    if (middle == begin || middle == end)
+    {
+        // All centers lie on one side, splitting further does not separate anything
+        if (size <= MAX_LEAF_SIZE)
+        {
+            setLeaf(node_index, begin, end);
+            return;
+        }
+        middle = begin + size / 2;
+    }
+
+    buildChildren(node_index, begin, middle, end, depth, splitAxis, TreeBuilder::MIDPOINT);
+}
+
+void KDTreeBuilder::buildSAH(const uint32_t node_index, const uint32_t begin, const uint32_t end, const int depth)
+{
+    const uint32_t size = end - begin;
+    const AABB box = bounds(begin, end);
+    setBounds(node_index, box);
+
+    if (size == 1 || depth >= MAX_DEPTH - 1)
+    {
+        setLeaf(node_index, begin, end);
+        return;
+    }
+
+    struct Bin
+    {
+        AABB bounds = AABB::empty();
+        uint32_t count = 0;
+    };
+
+    // Bin the entity centers along every axis and sweep the bins to find the cheapest split
+    const AABB center_box = centerBounds(begin, end);
+    const double leaf_cost = intersectionCost(size);
+    const double inverse_area = 1.0 / std::max(box.surfaceArea(), std::numeric_limits<double>::min());
+    double best_cost = std::numeric_limits<double>::infinity();
+    int best_axis = -1;
+    int best_bin = 0;
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        const double extent = center_box.high[axis] - center_box.low[axis];
+        if (extent <= 0.0)
+        {
+            continue;
+        }
+        const double scale = BIN_COUNT / extent;
+        std::array<Bin, BIN_COUNT> bins;
+        for (uint32_t i = begin; i < end; ++i)
+        {
+            const Primitive &primitive = primitives_[primitiveIndices_[i]];
+            const int bin = std::min(BIN_COUNT - 1, static_cast<int>((primitive.center[axis] - center_box.low[axis]) * scale));
+            bins[bin].bounds.expand(primitive.bounds);
+            bins[bin].count++;
+        }
+
+        std::array<double, BIN_COUNT - 1> right_cost;
+        AABB right_box = AABB::empty();
+        uint32_t right_count = 0;
+        for (int bin = BIN_COUNT - 1; bin > 0; --bin)
+        {
+            right_box.expand(bins[bin].bounds);
+            right_count += bins[bin].count;
+            right_cost[bin - 1] = right_box.surfaceArea() * intersectionCost(right_count);
+        }
+
+        AABB left_box = AABB::empty();
+        uint32_t left_count = 0;
+        for (int bin = 0; bin < BIN_COUNT - 1; ++bin)
+        {
+            left_box.expand(bins[bin].bounds);
+            left_count += bins[bin].count;
+            if (left_count == 0 || left_count == size)
+            {
+                continue;
+            }
+            const double cost = TRAVERSAL_COST
+                + (left_box.surfaceArea() * intersectionCost(left_count) + right_cost[bin]) * inverse_area;
+            if (cost < best_cost)
+            {
+                best_cost = cost;
+                best_axis = axis;
+                best_bin = bin;
+            }
+        }
+    }
+
+    const bool must_split = size > SAH_MAX_LEAF_SIZE;
+    if ((best_cost >= leaf_cost && !must_split) || (best_axis < 0 && size <= MAX_LEAF_SIZE))
+    {
+        setLeaf(node_index, begin, end);
+        return;
+    }
+
+    auto first = primitiveIndices_.begin() + begin;
+    auto last = primitiveIndices_.begin() + end;
+    uint32_t middle;
+    int split_axis = best_axis;
+    if (best_axis >= 0)
+    {
+        const double scale = BIN_COUNT / (center_box.high[best_axis] - center_box.low[best_axis]);
+        middle = std::partition(first, last, [&](const uint32_t index) {
+            const double center = primitives_[index].center[best_axis];
+            return std::min(BIN_COUNT - 1, static_cast<int>((center - center_box.low[best_axis]) * scale)) <= best_bin;
+        }) - primitiveIndices_.begin();
+    }
+    else
+    {
+        // All centers coincide, fall back to splitting the range in half
+        split_axis = 0;
+        middle = begin + size / 2;
+    }
+
+    buildChildren(node_index, begin, middle, end, depth, split_axis, TreeBuilder::SAH);
+}
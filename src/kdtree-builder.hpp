@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <limits>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+#include "entity.hpp"
+#include "kdtree-node.hpp"
+
+enum class TreeBuilder
+{
+    MIDPOINT,
+    SAH
+};
+
+// Summary of a built tree, used to compare builders on the same scene
+struct TreeStats
+{
+    TreeBuilder builder = TreeBuilder::SAH;
+    double build_seconds = 0.0;
+    size_t nodes = 0;
+    size_t leaves = 0;
+    int max_depth = 0;
+    double average_leaf_size = 0.0;
+    // Expected cost of a random ray through the tree, relative to the root surface area
+    double sah_cost = 0.0;
+};
+
+std::ostream& operator<<(std::ostream &os, const TreeStats &stats);
+
+class KDTreeBuilder
+{
+    public:
+        KDTreeBuilder(const std::vector<std::shared_ptr<Entity>> &entities,
+                      std::vector<KDN> &nodes, std::vector<uint32_t> &primitive_indices);
+        // Builds over plain bounding boxes. Leaves are assumed to test `batch_size` primitives at
+        // a cost of `batch_cost` traversal steps.
+        KDTreeBuilder(const std::vector<AABB> &bounds, std::vector<KDN> &nodes, std::vector<uint32_t> &primitive_indices,
+                      const uint32_t batch_size, const double batch_cost);
+
+        void build(const TreeBuilder builder);
+        TreeStats stats(const TreeBuilder builder) const;
+        // Stats of `node_count` nodes built earlier, with leaves costed like the builder's
+        static TreeStats stats(const TreeBuilder builder, const KDN *nodes, const size_t node_count,
+                               const uint32_t batch_size, const double batch_cost);
+
+        static constexpr int MAX_DEPTH = KDN::MAX_DEPTH;
+        static constexpr uint32_t MAX_LEAF_SIZE = std::numeric_limits<uint16_t>::max();
+        static constexpr double TRAVERSAL_COST = 1.0;
+        // Scene leaves test their primitives PACKET_SIZE at a time, one batch costs about three single intersections
+        static constexpr double BATCH_INTERSECTION_COST = 4.5;
+
+        static double intersectionCost(const uint32_t count, const uint32_t batch_size, const double batch_cost)
+        {
+            return batch_cost * ((count + batch_size - 1) / batch_size);
+        }
+        double intersectionCost(const uint32_t count) const
+        {
+            return intersectionCost(count, batchSize_, batchCost_);
+        }
+
+    private:
+        struct Primitive
+        {
+            AABB bounds;
+            Vec3 center;
+        };
+
+        static constexpr int BIN_COUNT = 32;
+        static constexpr uint32_t SAH_MAX_LEAF_SIZE = 16;
+        static constexpr uint32_t PARALLEL_THRESHOLD = 4096;
+
+        // Most primitives a node at `depth` may hold, so that halving it at every level still fits
+        // the forced leaves at MAX_DEPTH - 1
+        static uint64_t depthCapacity(const int depth);
+
+        void buildMidpoint(const uint32_t node_index, const uint32_t begin, const uint32_t end, const int depth);
+        void buildSAH(const uint32_t node_index, const uint32_t begin, const uint32_t end, const int depth);
+        void buildChildren(const uint32_t node_index, const uint32_t begin, uint32_t middle,
+                           const uint32_t end, const int depth, const int axis, const TreeBuilder builder);
+        void setLeaf(const uint32_t node_index, const uint32_t begin, const uint32_t end);
+        void setBounds(const uint32_t node_index, const AABB &box);
+        AABB bounds(const uint32_t begin, const uint32_t end) const;
+        AABB centerBounds(const uint32_t begin, const uint32_t end) const;
+
+        std::vector<KDN> &nodes_;
+        std::vector<uint32_t> &primitiveIndices_;
+        std::vector<Primitive> primitives_;
+        const uint32_t batchSize_;
+        const double batchCost_;
+        std::atomic<uint32_t> nodeCount_;
+};
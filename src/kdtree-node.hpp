@@ -0,0 +1,95 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "ray-packet.hpp"
+#include "shared-array.hpp"
+#include "vec3.hpp"
+
+// Node of the flattened tree. Inner nodes store the index of their first child in `offset`,
+// the second child directly follows it. Leaves reference `count` entries of the primitive
+// index array starting at `offset`.
+struct KDN
+{
+    float low[3];
+    float high[3];
+    uint32_t offset;
+    uint16_t count;
+    uint8_t axis;
+    uint8_t padding;
+
+    // Trees are never deeper than this, traversal stacks are sized for it
+    static constexpr int MAX_DEPTH = 64;
+
+    bool isLeaf() const { return count > 0; }
+    double surfaceArea() const;
+    bool intersect(const TraversalRay &ray) const;
+    PacketMask intersect(const RayPacket &packet, const Real t_min, const PacketReal &t_max) const;
+};
+
+static_assert(sizeof(KDN) == 32, "KDN should stay at half a cache line");
+
+inline float round_down(const Real value)
+{
+    const float f = static_cast<float>(value);
+    return f > value ? std::nextafter(f, -std::numeric_limits<float>::infinity()) : f;
+}
+
+inline float round_up(const Real value)
+{
+    const float f = static_cast<float>(value);
+    return f < value ? std::nextafter(f, std::numeric_limits<float>::infinity()) : f;
+}
+
+// Checks a tree read from a file before it is traversed. Children have to follow their parent,
+// which rules out cycles, no node may be deeper than MAX_DEPTH, so the fixed traversal stacks
+// suffice, and leaves have to stay within the `primitive_count` primitive indices.
+inline bool valid_tree(const SharedArray<KDN> &nodes, const size_t primitive_count)
+{
+    std::vector<int> depths(nodes.size(), 0);
+    for (size_t i = 0; i < nodes.size(); ++i)
+    {
+        const KDN &node = nodes[i];
+        const uint64_t end = static_cast<uint64_t>(node.offset) + (node.isLeaf() ? node.count : 2);
+        if (end > (node.isLeaf() ? primitive_count : nodes.size()) || depths[i] >= KDN::MAX_DEPTH)
+        {
+            return false;
+        }
+        if (!node.isLeaf())
+        {
+            if (node.offset <= i)
+            {
+                return false;
+            }
+            depths[node.offset] = std::max(depths[node.offset], depths[i] + 1);
+            depths[node.offset + 1] = std::max(depths[node.offset + 1], depths[i] + 1);
+        }
+    }
+    return true;
+}
+
+inline double KDN::surfaceArea() const
+{
+    const double x = high[0] - low[0];
+    const double y = high[1] - low[1];
+    const double z = high[2] - low[2];
+    return 2.0 * (x * y + y * z + z * x);
+}
+
+inline bool KDN::intersect(const TraversalRay &ray) const
+{
+    Real t_enter, t_exit;
+    slab_test(ray, low, high, t_enter, t_exit);
+    return std::max(t_enter, ray.t_min) <= std::min(t_exit, ray.t_max);
+}
+
+inline PacketMask KDN::intersect(const RayPacket &packet, const Real t_min, const PacketReal &t_max) const
+{
+    PacketReal t_enter, t_exit;
+    slab_test(packet, low, high, t_enter, t_exit);
+    return Simd::max(t_enter, Simd::broadcast(t_min)) <= Simd::min(t_exit, t_max);
+}
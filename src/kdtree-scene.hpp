@@ -1,22 +1,17 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <vector>
+
 #include "scene.hpp"
 #include "entity.hpp"
-
-static int ID_counter = 0;
-struct KDN
-{
-    int ID;
-    KDN(){
-        ID = ID_counter++;
-    }
-    AABB boundingBox;
-    int axis;
-    int depth;
-    bool f;
-    std::shared_ptr<KDN> left;
-    std::shared_ptr<KDN> right;
-    std::vector<std::shared_ptr<Entity>> entities;
-    virtual bool hit(const Ray& r, const double t_min, const double t_max, HitData &data) const;
-};
+#include "kdtree-builder.hpp"
+#include "primitive-arrays.hpp"
+#include "shared-array.hpp"
 
 class KDTreeScene: public Scene
 {
@@ -24,189 +19,368 @@ class KDTreeScene: public Scene
         KDTreeScene();
 
         virtual void update() override;
-        virtual bool hit(const Ray& r, const double t_min, const double t_max, HitData &data) const override;
+        virtual bool intersect(const TraversalRay &ray, HitData &data) const override;
+        virtual bool occludes(const TraversalRay &ray) const override;
+        virtual PacketMask hitPacket(const RayPacket &packet, const PacketMask &active, const Real t_min,
+                                     PacketReal &closest, HitPacket &data) const override;
+
+        // Uses a tree built earlier for the current entities instead of building one, the arrays may
+        // point into a mapped compiled scene. Returns false if the tree does not fit the entities.
+        bool setTree(SharedArray<KDN> nodes, SharedArray<uint32_t> primitive_indices);
+
+        // Updates the entities at `moved` and refits the nodes above them, so the cost follows the
+        // number of entities that moved rather than the size of the scene. Refitting keeps the tree's
+        // structure while its boxes grow apart, so the tree is rebuilt instead once its SAH cost
+        // exceeds REBUILD_THRESHOLD times the cost it was built with. Returns true if it was rebuilt.
+        bool refit(const std::vector<uint32_t> &moved);
 
+        const TreeStats& stats() const { return stats_; }
+        const SharedArray<KDN>& nodes() const { return nodes_; }
+        const SharedArray<uint32_t>& primitiveIndices() const { return primitiveIndices_; }
+
+        TreeBuilder builder = TreeBuilder::SAH;
+
+        // Packets with fewer active rays than this continue as single rays
+        static constexpr int MIN_PACKET_RAYS = 2;
+        static constexpr double REBUILD_THRESHOLD = 1.3;
 
     private:
-        std::shared_ptr<KDN> construct(std::vector<std::shared_ptr<Entity>> entities, const int depth);
-        std::shared_ptr<KDN> rootNode;
+        bool traverse(TraversalRay &ray, HitData &data, const uint32_t root) const;
+        // Records parents, the leaf and position of every entity and the SAH cost after a build
+        void indexTree();
+        // Area weighted cost of a node, summed over all nodes it gives the unnormalized SAH cost
+        double nodeCost(const KDN &node) const;
+        void refitNode(const uint32_t index);
+
+        SharedArray<KDN> nodes_;
+        SharedArray<uint32_t> primitiveIndices_;
+        PrimitiveArrays primitiveArrays_;
+        TreeStats stats_;
+
+        std::vector<uint32_t> parents_;
+        std::vector<uint32_t> entityLeaves_;
+        std::vector<uint32_t> entityPositions_;
+        // Marks nodes queued for refitting, all clear between refits
+        std::vector<uint8_t> refitMarks_;
+        double costSum_ = 0.0;
+        double builtCost_ = 0.0;
 };
 
-long hit_check_counter;
+// Nodes visited by the current thread, read and reset per pixel for the debug image
+thread_local long hit_check_counter;
 
-bool KDN::hit(const Ray& r, const double t_min, const double t_max, HitData &data) const
+KDTreeScene::KDTreeScene()
 {
-    hit_check_counter++;
-    if (!boundingBox.intersect(r))
+    hit_check_counter = 0;
+}
+
+void KDTreeScene::update()
+{
+    Scene::update();
+
+    const auto start_time = std::chrono::steady_clock::now();
+    std::vector<KDN> nodes;
+    std::vector<uint32_t> primitive_indices;
+    KDTreeBuilder tree_builder(entities, nodes, primitive_indices);
+    tree_builder.build(builder);
+    stats_ = tree_builder.stats(builder);
+    nodes_ = std::move(nodes);
+    primitiveIndices_ = std::move(primitive_indices);
+    primitiveArrays_.build(entities, nodes_, primitiveIndices_);
+    const std::chrono::duration<double> build_time = std::chrono::steady_clock::now() - start_time;
+
+    stats_.build_seconds = build_time.count();
+    indexTree();
+}
+
+bool KDTreeScene::setTree(SharedArray<KDN> nodes, SharedArray<uint32_t> primitive_indices)
+{
+    if (primitive_indices.size() != entities.size())
     {
         return false;
     }
-    if (depth == data.debugStep)
+    for (const uint32_t index : primitive_indices)
     {
-        // data.debugColor = f ? Vec3(1,0,0) : Vec3(0,1,0);
-        // data.debug = true;
-        // data.debugCounter++;
+        if (index >= entities.size())
+        {
+            return false;
+        }
     }
-
-    std::shared_ptr<KDN> first;
-    std::shared_ptr<KDN> second;
-    if (r.direction()[axis] > 0)
+    if (!valid_tree(nodes, primitive_indices.size()))
     {
-        first = left;
-        second = right;
+        return false;
     }
-    else
+
+    Scene::update();
+    nodes_ = std::move(nodes);
+    primitiveIndices_ = std::move(primitive_indices);
+    primitiveArrays_.build(entities, nodes_, primitiveIndices_);
+    stats_ = KDTreeBuilder::stats(builder, nodes_.data(), nodes_.size(), PACKET_SIZE,
+                                  KDTreeBuilder::BATCH_INTERSECTION_COST);
+    indexTree();
+    return true;
+}
+
+void KDTreeScene::indexTree()
+{
+    parents_.assign(nodes_.size(), 0);
+    entityLeaves_.assign(entities.size(), 0);
+    entityPositions_.assign(entities.size(), 0);
+    refitMarks_.assign(nodes_.size(), 0);
+    costSum_ = 0.0;
+    for (uint32_t index = 0; index < nodes_.size(); ++index)
     {
-        first = right;
-        second = left;
+        const KDN &node = nodes_[index];
+        costSum_ += nodeCost(node);
+        if (!node.isLeaf())
+        {
+            parents_[node.offset] = index;
+            parents_[node.offset + 1] = index;
+            continue;
+        }
+        for (uint32_t position = node.offset; position < node.offset + node.count; ++position)
+        {
+            entityLeaves_[primitiveIndices_[position]] = index;
+            entityPositions_[primitiveIndices_[position]] = position;
+        }
     }
-    
-    double t_far = t_max;
-    bool hit_first = false;
-    if (first)
+    builtCost_ = stats_.sah_cost;
+}
+
+double KDTreeScene::nodeCost(const KDN &node) const
+{
+    const double cost = node.isLeaf() ? KDTreeBuilder::intersectionCost(node.count, PACKET_SIZE,
+                                                                        KDTreeBuilder::BATCH_INTERSECTION_COST)
+                                      : KDTreeBuilder::TRAVERSAL_COST;
+    return node.surfaceArea() * cost;
+}
+
+void KDTreeScene::refitNode(const uint32_t index)
+{
+    KDN &node = nodes_[index];
+    costSum_ -= nodeCost(node);
+    if (node.isLeaf())
     {
-        hit_first = first->hit(r, t_min, t_far, data);
-        if (hit_first)
+        AABB box = AABB::empty();
+        for (uint32_t position = node.offset; position < node.offset + node.count; ++position)
         {
-            t_far = data.t;
+            box.expand(entities[primitiveIndices_[position]]->boundingBox);
+        }
+        for (int i = 0; i < 3; ++i)
+        {
+            node.low[i] = round_down(box.low[i]);
+            node.high[i] = round_up(box.high[i]);
         }
     }
-    bool hit_second = false;
-    if (second)
+    else
     {
-        hit_second = second->hit(r, t_min, t_far, data);
-        if (hit_second)
+        const KDN &first = nodes_[node.offset];
+        const KDN &second = nodes_[node.offset + 1];
+        for (int i = 0; i < 3; ++i)
         {
-            t_far = data.t;
+            node.low[i] = std::min(first.low[i], second.low[i]);
+            node.high[i] = std::max(first.high[i], second.high[i]);
         }
     }
-    if (hit_first || hit_second)
+    costSum_ += nodeCost(node);
+}
+
+bool KDTreeScene::refit(const std::vector<uint32_t> &moved)
+{
+    if (nodes_.empty())
     {
+        update();
         return true;
     }
 
-    HitData temp_data;
-    double closest_hit = t_far;
-    for (const auto e : entities)
+    // Queue the leaves of the moved entities and everything above them
+    std::vector<uint32_t> queued;
+    bool moved_light = false;
+    for (const uint32_t entity : moved)
     {
-        if (e->hit(r, t_min, closest_hit, data))
+        entities[entity]->update();
+        moved_light |= entities[entity]->emissive;
+        primitiveArrays_.refresh(entityPositions_[entity]);
+        uint32_t index = entityLeaves_[entity];
+        while (!refitMarks_[index])
         {
-            closest_hit = data.t;
+            refitMarks_[index] = 1;
+            queued.push_back(index);
+            if (index == 0)
+            {
+                break;
+            }
+            index = parents_[index];
         }
     }
-    return closest_hit < t_max;
-}
 
-KDTreeScene::KDTreeScene()
-{
-    hit_check_counter = 0;
+    // Children follow their parent in the node array, so refitting from the back sees every child first
+    std::sort(queued.begin(), queued.end(), std::greater<uint32_t>());
+    for (const uint32_t index : queued)
+    {
+        refitNode(index);
+        refitMarks_[index] = 0;
+    }
+
+    const KDN &root = nodes_[0];
+    boundingBox = {Vec3(root.low[0], root.low[1], root.low[2]), Vec3(root.high[0], root.high[1], root.high[2])};
+    transform = (boundingBox.low + boundingBox.high) / 2.0;
+    stats_.sah_cost = costSum_ / std::max(root.surfaceArea(), std::numeric_limits<double>::min());
+    if (stats_.sah_cost > builtCost_ * REBUILD_THRESHOLD)
+    {
+        update();
+        return true;
+    }
+    if (moved_light)
+    {
+        // The light tree is small next to the scene's, it is simply built again
+        lights.build(emissive_entities, materials);
+    }
+    return false;
 }
 
-void KDTreeScene::update()
+bool KDTreeScene::intersect(const TraversalRay &ray, HitData &data) const
 {
-    Scene::update();
-    rootNode = construct(entities, 0);
+    // There is no tree, naively check all entities
+    if (nodes_.empty())
+    {
+        return Scene::intersect(ray, data);
+    }
+
+    TraversalRay closest = ray;
+    return traverse(closest, data, 0);
 }
 
-bool KDTreeScene::hit(const Ray& r, const double t_min, const double t_max, HitData &data) const
+bool KDTreeScene::occludes(const TraversalRay &ray) const
 {
-    // A tree exists, use it to find hit points
-    data.t = t_max;
-    if (rootNode)
+    if (nodes_.empty())
     {
-        return rootNode->hit(r, t_min, t_max, data);
+        return Scene::occludes(ray);
+    }
+    if (occludedByLast(ray))
+    {
+        return true;
     }
 
-    // There is no tree, naively check all entities
-    double closest_hit = t_max;
-    for (const auto &e : entities)
+    uint32_t stack[KDTreeBuilder::MAX_DEPTH * 2];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+    while (stack_size > 0)
     {
-        if (e->hit(r, t_min, closest_hit, data))
+        const KDN &node = nodes_[stack[--stack_size]];
+        hit_check_counter++;
+        if (!node.intersect(ray))
+        {
+            continue;
+        }
+
+        if (node.isLeaf())
         {
-            closest_hit = data.t;
+            const int64_t position = primitiveArrays_.occluder(ray, node);
+            if (position >= 0)
+            {
+                rememberOccluder(primitiveIndices_[position]);
+                return true;
+            }
+            continue;
         }
+
+        const uint32_t near = ray.sign[node.axis];
+        stack[stack_size++] = node.offset + 1 - near;
+        stack[stack_size++] = node.offset + near;
     }
-    return closest_hit < t_max;
+    return false;
 }
 
-std::shared_ptr<KDN> KDTreeScene::construct(const std::vector<std::shared_ptr<Entity>> entities, const int depth)
+bool KDTreeScene::traverse(TraversalRay &ray, HitData &data, const uint32_t root) const
 {
-    auto node = std::make_shared<KDN>();
-    node->left = 0;
-    node->right = 0;
-    node->axis = 0;
-    node->depth = depth;
-
-    if (entities.size() == 0)
+    bool found = false;
+    uint32_t stack[KDTreeBuilder::MAX_DEPTH * 2];
+    int stack_size = 0;
+    stack[stack_size++] = root;
+    while (stack_size > 0)
     {
-        std::cout << "empty leaf " << depth << std::endl;
-        return node;
-    }
+        const KDN &node = nodes_[stack[--stack_size]];
+        hit_check_counter++;
+        // Also culls nodes that start behind the closest hit found so far
+        if (!node.intersect(ray))
+        {
+            continue;
+        }
 
-    node->boundingBox = entities[0]->boundingBox;
+        if (node.isLeaf())
+        {
+            found |= primitiveArrays_.intersect(ray, node, data);
+            continue;
+        }
 
-    Vec3 averagePosition(0.0f);
-    for (auto& entity : entities)
-    {
-        averagePosition += entity->transform;
-        node->boundingBox.expand(entity->boundingBox);
+        // Push the far child first so the near one is visited first
+        const uint32_t near = ray.sign[node.axis];
+        stack[stack_size++] = node.offset + 1 - near;
+        stack[stack_size++] = node.offset + near;
     }
-    averagePosition /= entities.size();
+    return found;
+}
 
-    if (entities.size() <= 4 || depth > 8)
+PacketMask KDTreeScene::hitPacket(const RayPacket &packet, const PacketMask &active, const Real t_min,
+                                  PacketReal &closest, HitPacket &data) const
+{
+    // Rays pointing into different octants disagree on the child order, trace them one by one
+    if (nodes_.empty() || !packet.coherent())
     {
-        std::cout << "leaf with " << entities.size() << " objects " << depth << std::endl;
-        for (auto &e : entities)
-        {
-            node->entities.emplace_back(e);
-        }
-        return node;
+        return Entity::hitPacket(packet, active, t_min, closest, data);
     }
 
-
-    // Find largest bounding box dimension
-    const Vec3 boundingBoxSize = node->boundingBox.high - node->boundingBox.low;
-    int splitAxis;
-    if (boundingBoxSize[0] >= boundingBoxSize[1] && boundingBoxSize[0] >= boundingBoxSize[2])
+    int first_lane = 0;
+    while (!active[first_lane])
     {
-        splitAxis = 0;
+        first_lane++;
     }
-    else
+    uint32_t near[3];
+    for (int i = 0; i < 3; ++i)
     {
-        splitAxis = boundingBoxSize[1] >= boundingBoxSize[2] ? 1 : 2;
+        near[i] = packet.inverse_direction[i][first_lane] < 0 ? 1 : 0;
     }
-    node->axis = splitAxis;
-    
-    std::cout << "Axis: " << splitAxis << std::endl;
 
-    std::vector<std::shared_ptr<Entity>> leftEntities;
-    std::vector<std::shared_ptr<Entity>> rightEntities;
-    for (auto& entity : entities)
+    PacketMask hits = {};
+    uint32_t stack[KDTreeBuilder::MAX_DEPTH * 2];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+    while (stack_size > 0)
     {
-        if (entity->transform[splitAxis] < averagePosition[splitAxis])
+        const uint32_t node_index = stack[--stack_size];
+        const KDN &node = nodes_[node_index];
+        hit_check_counter++;
+        const PacketMask node_active = active & node.intersect(packet, t_min, closest);
+        const int active_rays = Simd::count(node_active);
+        if (active_rays == 0)
         {
-            leftEntities.emplace_back(entity);
+            continue;
         }
-        else
+
+        // The packet diverged, finish this subtree with single rays
+        if (active_rays < MIN_PACKET_RAYS)
         {
-            rightEntities.emplace_back(entity);
+            for (int lane = 0; lane < PACKET_SIZE; ++lane)
+            {
+                TraversalRay ray(packet.rays[lane], t_min, closest[lane]);
+                if (node_active[lane] && traverse(ray, data[lane], node_index))
+                {
+                    closest[lane] = ray.t_max;
+                    hits[lane] = -1;
+                }
+            }
+            continue;
         }
-    }
 
-    if (leftEntities.size() > 0)
-    {
-        std::cout << "constructing left node" << std::endl;
-        node->left = construct(leftEntities, depth + 1);
-        node->boundingBox.expand(node->left->boundingBox);
-        node->left->f = true;
-    }
-    if (rightEntities.size() > 0)
-    {
-        std::cout << "constructing right node" << std::endl;
-        node->right = construct(rightEntities, depth + 1);
-        node->boundingBox.expand(node->right->boundingBox);
-        node->right->f = false;
-    }
+        if (node.isLeaf())
+        {
+            hits |= primitiveArrays_.hitPacket(packet, node, node_active, t_min, closest, data);
+            continue;
+        }
 
-    return node;
+        stack[stack_size++] = node.offset + 1 - near[node.axis];
+        stack[stack_size++] = node.offset + near[node.axis];
+    }
+    return hits;
 }
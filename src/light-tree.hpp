@@ -0,0 +1,177 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <numeric>
+#include <vector>
+
+#include "entity.hpp"
+#include "material.hpp"
+#include "pixel-estimate.hpp"
+#include "sampler.hpp"
+
+// Binary tree over the emissive entities for picking the light a sample goes to. Every node
+// bounds its lights and sums their power. A shading point walks down from the root and picks
+// each child in proportion to its power over the squared distance to the child's bounds, so a
+// light is found in O(log lights) with a probability that favours the bright and near ones.
+class LightTree
+{
+    public:
+        // Lights are weighted by the luminance of their emissive color, entities without a single
+        // material count as a unit of power
+        void build(const std::vector<std::shared_ptr<Entity>> &lights, const std::vector<Material> &materials);
+
+        // Picks a light for the shading point of `data`, its index in the list the tree was built from
+        // and the probability it was picked with. The entity that was hit is never picked, false if
+        // no light is left to pick.
+        bool sample(const HitData &data, Sampler &sampler, uint32_t &light, double &pdf) const;
+
+        bool empty() const { return nodes_.empty(); }
+
+    private:
+        struct Node
+        {
+            AABB bounds;
+            double power;
+            // Leaves hold the light's index, inner nodes the index of their first child, the second follows it
+            uint32_t offset;
+            bool leaf;
+        };
+
+        void buildNode(const uint32_t index, const uint32_t begin, const uint32_t end, const std::vector<double> &powers,
+                       const std::vector<Vec3> &centers);
+        double importance(const Node &node, const HitData &data) const;
+
+        std::vector<Node> nodes_;
+        std::vector<uint32_t> order_;
+        std::vector<const Entity*> lights_;
+};
+
+void LightTree::build(const std::vector<std::shared_ptr<Entity>> &lights, const std::vector<Material> &materials)
+{
+    nodes_.clear();
+    lights_.clear();
+    order_.resize(lights.size());
+    std::iota(order_.begin(), order_.end(), 0);
+    if (lights.empty())
+    {
+        return;
+    }
+
+    std::vector<double> powers(lights.size());
+    std::vector<Vec3> centers(lights.size());
+    for (size_t i = 0; i < lights.size(); ++i)
+    {
+        MaterialId material;
+        powers[i] = lights[i]->surfaceMaterial(material) && material < materials.size()
+            ? luminance(Vec3d(materials[material].emissive)) : 1.0;
+        centers[i] = (lights[i]->boundingBox.low + lights[i]->boundingBox.high) / 2.0f;
+        lights_.push_back(lights[i].get());
+    }
+    // A binary tree with one light per leaf
+    nodes_.reserve(2 * lights.size() - 1);
+    nodes_.emplace_back();
+    buildNode(0, 0, static_cast<uint32_t>(lights.size()), powers, centers);
+}
+
+void LightTree::buildNode(const uint32_t index, const uint32_t begin, const uint32_t end,
+                          const std::vector<double> &powers, const std::vector<Vec3> &centers)
+{
+    Node node;
+    node.bounds = AABB::empty();
+    node.power = 0.0;
+    AABB centroids = AABB::empty();
+    for (uint32_t i = begin; i < end; ++i)
+    {
+        node.bounds.expand(lights_[order_[i]]->boundingBox);
+        node.power += powers[order_[i]];
+        centroids.expand(centers[order_[i]]);
+    }
+    if (end - begin == 1)
+    {
+        node.offset = order_[begin];
+        node.leaf = true;
+        nodes_[index] = node;
+        return;
+    }
+
+    // Split at the median along the axis the centers spread the most
+    const Vec3 extent = centroids.high - centroids.low;
+    int axis = 0;
+    for (int i = 1; i < 3; ++i)
+    {
+        if (extent[i] > extent[axis])
+        {
+            axis = i;
+        }
+    }
+    const uint32_t middle = begin + (end - begin) / 2;
+    std::nth_element(order_.begin() + begin, order_.begin() + middle, order_.begin() + end,
+                     [&](const uint32_t a, const uint32_t b) { return centers[a][axis] < centers[b][axis]; });
+
+    node.offset = static_cast<uint32_t>(nodes_.size());
+    node.leaf = false;
+    nodes_[index] = node;
+    nodes_.emplace_back();
+    nodes_.emplace_back();
+    buildNode(node.offset, begin, middle, powers, centers);
+    buildNode(node.offset + 1, middle, end, powers, centers);
+}
+
+double LightTree::importance(const Node &node, const HitData &data) const
+{
+    if (node.leaf && lights_[node.offset] == data.entity)
+    {
+        return 0.0;
+    }
+    // Points within the bounds are taken to be half the diagonal away, which also keeps it finite
+    const Vec3 center = (node.bounds.low + node.bounds.high) / 2.0f;
+    const Vec3 diagonal = node.bounds.high - node.bounds.low;
+    const double distance2 = std::max<double>((data.hit_point - center).squaredLength(), diagonal.dot(diagonal) / 4.0);
+    return node.power / distance2;
+}
+
+bool LightTree::sample(const HitData &data, Sampler &sampler, uint32_t &light, double &pdf) const
+{
+    if (nodes_.empty() || importance(nodes_[0], data) <= 0.0)
+    {
+        return false;
+    }
+
+    // One uniform number is drawn for the first choice and rescaled to pick every following one.
+    // A single light draws none.
+    double u = -1.0;
+    uint32_t index = 0;
+    pdf = 1.0;
+    while (!nodes_[index].leaf)
+    {
+        const Node &node = nodes_[index];
+        const double left = importance(nodes_[node.offset], data);
+        const double right = importance(nodes_[node.offset + 1], data);
+        if (left + right <= 0.0)
+        {
+            return false;
+        }
+        const double p_left = left / (left + right);
+        if (u < 0.0)
+        {
+            u = sampler.get1D();
+        }
+        if (u < p_left)
+        {
+            u = std::min(u / p_left, std::nextafter(1.0, 0.0));
+            pdf *= p_left;
+            index = node.offset;
+        }
+        else
+        {
+            u = std::min((u - p_left) / (1.0 - p_left), std::nextafter(1.0, 0.0));
+            pdf *= 1.0 - p_left;
+            index = node.offset + 1;
+        }
+    }
+    light = nodes_[index].offset;
+    return true;
+}
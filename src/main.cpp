@@ -5,31 +5,46 @@
 #include <execution>
 #include <fstream>
 #include <iostream>
-#include <mutex>
-#include <thread>
 #include <iomanip>
 
 #include "vec3.hpp"
 #include "ray.hpp"
+#include "ray-packet.hpp"
 #include "sphere.hpp"
 #include "scene.hpp"
 #include "camera.hpp"
 #include "random.hpp"
+#include "sampler.hpp"
 #include "material.hpp"
-#include "metal.hpp"
-#include "lambertian.hpp"
-#include "physics-material.hpp"
 #include "kdtree-scene.hpp"
 #include "box.hpp"
+#include "triangle-mesh.hpp"
+#include "obj-loader.hpp"
+#include "instance.hpp"
+#include "transform.hpp"
+#include "compiled-scene.hpp"
+#include "denoiser.hpp"
 #include "image.hpp"
+#include "pixel-estimate.hpp"
+#include "frame-writer.hpp"
+#include "progress.hpp"
+#include "scene-description.hpp"
+#include "shading.hpp"
+#include "temporal-cache.hpp"
+#include "tile-scheduler.hpp"
+#include "wavefront.hpp"
 
 
-Vec3 castRay(const Ray &r, const KDTreeScene &scene, const int depth, HitData &data)
+Vec3 castRay(const Ray &r, const KDTreeScene &scene, const PathSettings &path, const int depth, const Vec3 &throughput,
+             HitData &data, Sampler &sampler);
+
+// Computes the color seen along `r` once the closest hit (or miss) has been found. `throughput` is
+// the attenuation of the path up to `r`.
+Vec3 shade(const Ray &r, const KDTreeScene &scene, const PathSettings &path, const int depth, const Vec3 &throughput,
+           HitData &data, const bool hit, Sampler &sampler)
 {
-    const int lightSamples = 10;
-    data.debugCounter = 0;
     Vec3 color(0.0f);
-    if (scene.hit(r, 0.001f, 1000.0f, data))
+    if (hit)
     {
         // return data.normal;
         if (data.debug)
@@ -39,56 +54,33 @@ Vec3 castRay(const Ray &r, const KDTreeScene &scene, const int depth, HitData &d
         Ray scattered;
         Vec3 attenuation;
 
-        auto pbm = std::dynamic_pointer_cast<const PhysicsMaterial>(data.material);
-        assert(pbm && "Non physics material");
+        const Material &material = scene.materials[data.material];
 
+        sampler.beginBounce(depth);
         double sunlight = 1.0f;
-        const Ray sunray = Ray(data.hit_point + data.normal * 0.001f, Vec3(1, 1 ,-1).normalized());
-        HitData dummydata;
-        if (scene.hit(sunray, 0.001f, 1000.0f, dummydata))
+        if (scene.occluded(sun_ray(data), RAY_T_MIN, RAY_T_MAX))
         {
-            sunlight = 0.2f;
+            sunlight = SUN_SHADOW;
         }
-        for (auto &e : scene.emissive_entities)
+        for (int i = 0; i < LIGHT_SAMPLES; ++i)
         {
-            if (e == data.entity)
-            {
-                continue;
-            }
-            const Vec3 half_dimensions = (e->boundingBox.high - e->boundingBox.low) / 2.0f;
-            const double half_size = half_dimensions.length();
-            const double dist = (e->transform - data.hit_point).length();
-            const double max_dist = dist + half_size;
-            const double min_dist = dist - half_size;
-            HitData lightData;
-            for (int i=0; i < lightSamples; ++i)
+            Ray lightray;
+            Real t_max;
+            Vec3 contribution;
+            if (sample_light(scene, data, material, sampler, lightray, t_max, contribution)
+                && !scene.occluded(lightray, RAY_T_MIN, t_max))
             {
-                const Vec3 target = e->transform + random_unit_sphere() * half_size;
-                const Ray lightray = Ray(data.hit_point + data.normal * 0.001f, (target - data.hit_point).normalized());
-                if (scene.hit(lightray, 0.001f, max_dist, lightData))
-                {
-                    Vec3 light(0.0f);
-                    if (lightData.entity == e)
-                    {
-                        auto lightpbm = std::dynamic_pointer_cast<const PhysicsMaterial>(lightData.material);
-                        assert(lightpbm && "Non physics light material");
-
-                        light += lightpbm->emissive / (lightData.t * lightData.t);
-                    }
-                    color += pbm->diffuse * light / lightSamples;
-                }
+                color += contribution;
             }
         }
-        color += pbm->ambient;
-        color += pbm->emissive;
-        color += pbm->diffuse * sunlight;
+        color += material.ambient;
+        color += material.emissive;
+        color += material.diffuse * sunlight;
         HitData temp_data;
-        if (data.material->scatter(r, data, attenuation, scattered))
+        if (can_scatter(path, depth, material) && material.scatter(r, data, attenuation, scattered, sampler)
+            && continue_path(path, depth, throughput, attenuation, sampler))
         {
-            if (depth < 5)
-            {
-                color += pbm->reflective * castRay(scattered, scene, depth + 1, temp_data);
-            }
+            color += attenuation * castRay(scattered, scene, path, depth + 1, throughput * attenuation, temp_data, sampler);
         }
     }
     else
@@ -97,116 +89,259 @@ Vec3 castRay(const Ray &r, const KDTreeScene &scene, const int depth, HitData &d
         {
             return data.debugColor * (1.0f - 1.0f / data.debugCounter);
         }
-        Vec3 unit_direction = r.direction().normalized();
-        double t = 0.5 * (unit_direction.y() + 1.0f);
-        color += (1.0f - t) * Vec3(1.0, 1.0, 1.0) + t * Vec3(0.5, 0.7, 1.0);
-        color *= 0.1;
+        color = sky(r);
     }
     return color;
 }
 
-auto spawn_sphere(Scene &scene, const Vec3 &position, const float radius, const std::shared_ptr<Material> &material)
+Vec3 castRay(const Ray &r, const KDTreeScene &scene, const PathSettings &path, const int depth, const Vec3 &throughput,
+             HitData &data, Sampler &sampler)
+{
+    data.debugCounter = 0;
+    const bool hit = scene.hit(r, RAY_T_MIN, RAY_T_MAX, data);
+    return shade(r, scene, path, depth, throughput, data, hit, sampler);
+}
+
+// Adds a camera sample to `estimate` along with the normal and albedo of its first hit
+void add_sample(PixelEstimate &estimate, const Vec3 &color, const HitData &data, const bool hit, const KDTreeScene &scene)
 {
-    std::shared_ptr<Sphere> sphere = std::make_shared<Sphere>(position, radius, material);
-    scene.entities.emplace_back(sphere);
-    return sphere;
+    const Vec3d normal = hit ? Vec3d(data.normal) : Vec3d();
+    const Vec3d albedo = hit ? Vec3d(surface_albedo(scene.materials[data.material])) : Vec3d();
+    estimate.add(Vec3d(color), data.t, normal, albedo);
 }
 
-auto spawn_box(Scene &scene, const Vec3 &position, const Vec3 &dimensions, const std::shared_ptr<Material> &material)
+// Finds the primary hits of up to PACKET_SIZE rays in one traversal and shades each ray on its own.
+// Adds every ray's sample to `estimate`.
+void castPacket(const Ray *rays, const int size, const KDTreeScene &scene, const PathSettings &path, Sampler *samplers,
+                PixelEstimate &estimate)
 {
-    std::shared_ptr<Box> box = std::make_shared<Box>(position, dimensions, material);
-    scene.entities.emplace_back(box);
-    return box;
+    HitPacket data;
+    for (int lane = 0; lane < size; ++lane)
+    {
+        data[lane].debugCounter = 0;
+        data[lane].t = RAY_T_MAX;
+    }
+    const RayPacket packet(rays, size);
+    PacketReal closest = Simd::broadcast(RAY_T_MAX);
+    const PacketMask hits = scene.hitPacket(packet, packet.active, RAY_T_MIN, closest, data);
+    for (int lane = 0; lane < size; ++lane)
+    {
+        if (hits[lane])
+        {
+            data[lane].entity->interact(rays[lane], data[lane]);
+        }
+        const Vec3 color = shade(rays[lane], scene, path, 0, Vec3(1.0f), data[lane], hits[lane] != 0, samplers[lane]);
+        add_sample(estimate, color, data[lane], hits[lane] != 0, scene);
+    }
 }
 
-KDTreeScene make_test_scene()
+// Progress of one pixel's samples
+struct PixelJob
+{
+    int index;
+    int i;
+    int j;
+    PixelEstimate estimate;
+    // Samples carried over from the previous frame and traced in this one
+    int history = 0;
+    int sample = 0;
+    // Surface seen through the pixel center, only traced for temporal reuse
+    HitData center;
+    bool center_hit = false;
+};
+
+// Built-in scene used when no scene file is given, scenes/test.scene describes the same scene
+SceneDescription make_test_scene()
 {
-    auto steel = std::make_shared<PhysicsMaterial>(
+    SceneDescription scene;
+    scene.frames = 250;
+    scene.vertical_fov = 25;
+    scene.camera_keys = {{0, Vec3(3), Vec3(-0.0001)}, {1, Vec3(0.0001), Vec3(-0.0001)}};
+
+    const MaterialId steel = scene.addMaterial(Material::physics(
         Vec3(0.2, 0.2, 0.2),
         Vec3(0.8, 0.8, 0.8),
         0.02
-    );
-    auto iron = std::make_shared<PhysicsMaterial>(
+    ));
+    const MaterialId iron = scene.addMaterial(Material::physics(
         Vec3(0.2, 0.2, 0.2),
         Vec3(0.4, 0.4, 0.4),
         0.1
-    );
-    auto felt = std::make_shared<PhysicsMaterial>(
-        Vec3(0.8, 0.83, 0.8),
-        Vec3(0.0),
-        0.0
-    );
-    auto red_felt = std::make_shared<PhysicsMaterial>(
+    ));
+    const MaterialId red_felt = scene.addMaterial(Material::physics(
         Vec3(0.8, 0.2, 0.2),
         Vec3(0.0),
         0.0
-    );
-    auto thing = std::make_shared<PhysicsMaterial>(
+    ));
+    Material thing_material = Material::physics(
         Vec3(0.5,0.2,0.2),
         Vec3(0.2,0.5,0.2),
         0.01
     );
-    thing->emissive = Vec3(0.5);
+    thing_material.emissive = Vec3(0.5);
+    const MaterialId thing = scene.addMaterial(thing_material);
 
-    KDTreeScene scene;
+    scene.addSphere(Vec3(0, -100.5, 0), 100, steel);
 
-    spawn_sphere(scene, Vec3(0, -100.5, 0), 100, steel);
+    scene.addSphere(Vec3(0.5, 0.5, 0), 0.25, iron);
 
-    spawn_sphere(scene, Vec3(0.5, 0.5, 0), 0.25, iron);
-
-    spawn_sphere(scene, Vec3(-1, 0, 0), 0.5, steel);
-    spawn_sphere(scene, Vec3(0, 0, 0), 0.25, thing)->emissive = true;
-    spawn_sphere(scene, Vec3(1, 0, 0), 0.5, steel);
+    scene.addSphere(Vec3(-1, 0, 0), 0.5, steel);
+    scene.addSphere(Vec3(0, 0, 0), 0.25, thing, true);
+    scene.addSphere(Vec3(1, 0, 0), 0.5, steel);
     int w = 5;
     int h = 5;
     for (int i = 0; i < w * h; ++i)
     {
         Vec3 p = Vec3(i / w, i % w, 0) / w - Vec3(0.4);
         p[2] = 0.5f;
-        spawn_sphere(scene, p, 0.09, steel);
+        scene.addSphere(p, 0.09, steel);
     }
-    spawn_box(scene, Vec3(0, 0, -1), Vec3(1, 1, 1), iron);
-    spawn_box(scene, Vec3(0, 1, -3), Vec3(1, 1, 1), red_felt);
-    spawn_box(scene, Vec3(0, 2, -1), Vec3(1, 1, 1), iron);
-
-    // spawn_sphere(scene, Vec3(-0.5, 0, 0), 0.5, steel);
-    // spawn_sphere(scene, Vec3(0, 0, 0), 0.25, red_felt);
-    // spawn_sphere(scene, Vec3(0.5, 0, 0), 0.5, steel);
-
-    scene.update();
+    scene.addBox(Vec3(0, 0, -1), Vec3(1, 1, 1), iron);
+    scene.addBox(Vec3(0, 1, -3), Vec3(1, 1, 1), red_felt);
+    scene.addBox(Vec3(0, 2, -1), Vec3(1, 1, 1), iron);
 
     return scene;
 }
 
-template<typename T>
-inline T lerp(double f, T a, T b)
-{
-    return (1.0f - f) * a + f * b;
-}
-
 int main(const int argc, const char* argv[])
 {
-    const int metasteps = 250;
     const int substeps = 1;
-    const int steps = metasteps * substeps;
-    const int samples = 100;
+    // Upper bound of samples per pixel, the denoiser takes care of the remaining noise
+    const int samples = 16;
+    // Every pixel takes at least min_samples, then stops once the 95% confidence interval of its
+    // luminance is within adaptive_threshold of the mean. A threshold of 0 disables adaptive sampling.
+    const int min_samples = 8;
+    const double adaptive_threshold = 0.05;
+    // Continue the estimates of the previous frame where the same surface is still visible. Such
+    // pixels carry at most temporal_history samples over and add at least temporal_min_samples.
+    const bool temporal = false;
+    const int temporal_history = 64;
+    const int temporal_min_samples = 4;
+    // Paths are always traced up to min_path_depth bounces, then dim ones are ended by Russian
+    // roulette, and none goes beyond max_path_depth. The camera ray has depth 0, setting both
+    // depths to the same value turns the roulette off.
+    const int min_path_depth = 1;
+    const int max_path_depth = 5;
+    const PathSettings path_settings{min_path_depth, max_path_depth};
+    // Source of the sample values, low discrepancy samplers converge faster than independent numbers
+    const SamplerType sampler_type = SamplerType::BLUE_NOISE;
+    // Trace the primary rays of a pixel as SIMD packets
+    const bool use_packets = true;
+    // Trace the samples of a whole tile as one batch of paths, stage by stage, instead of recursively per sample
+    const bool use_wavefront = false;
+    // Filter the noise out of every frame, guided by depth, normals and albedo. The filter adapts to
+    // each pixel's remaining noise, so lower sample counts trade noise for a slight blur.
+    const bool denoise = true;
     const double resolution_factor = 1.0;
     const int width = 1920 * resolution_factor;
     const int height = 1080 * resolution_factor;
+    const int tile_size = 16;
+    const TileOrder tile_order = TileOrder::SPIRAL;
 
-    auto s = make_test_scene();
-    Camera camera(Vec3(0,0,1), Vec3(-0.0001), 25, static_cast<double>(width) / height);
+    if (argc > 1 && strcmp(argv[1], "compile") == 0)
+    {
+        // Turn a text scene into a compiled scene, including its tree
+        if (argc != 4)
+        {
+            std::cerr << "Usage: " << argv[0] << " compile <scene> <output.rtscene>\n";
+            return 1;
+        }
+        SceneDescription description;
+        KDTreeScene scene;
+        if (!load_scene(argv[2], description, scene) || !write_compiled_scene(argv[3], description, scene))
+        {
+            return 1;
+        }
+        std::cout << scene.stats() << "\n" << "Wrote " << argv[3] << "\n";
+        return 0;
+    }
 
-    std::chrono::steady_clock::time_point last_update = std::chrono::steady_clock::now();
-    std::chrono::steady_clock::time_point last_save = std::chrono::steady_clock::now();
+    // The optional second argument is a scene file, text or compiled
+    const auto load_start_time = std::chrono::steady_clock::now();
+    SceneDescription description;
+    KDTreeScene s;
+    if (argc > 2)
+    {
+        if (!load_scene(argv[2], description, s))
+        {
+            return 1;
+        }
+    }
+    else
+    {
+        description = make_test_scene();
+        description.populate(s);
+        s.update();
+    }
+    const std::chrono::duration<double> load_time = std::chrono::steady_clock::now() - load_start_time;
+    std::cout << "Scene loaded in " << load_time.count() * 1000.0 << "ms\n";
+    std::cout << s.stats() << "\n";
+    const int metasteps = description.frames;
+    const int steps = metasteps * substeps;
+    if (argc > 1 && strcmp(argv[1], "trees") == 0)
+    {
+        // Compare the tree builders on the same scene
+        for (const auto builder : {TreeBuilder::MIDPOINT, TreeBuilder::SAH})
+        {
+            s.builder = builder;
+            s.update();
+            std::cout << s.stats() << "\n";
+        }
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "refit") == 0)
+    {
+        // Move a few spheres every frame and refit the tree to them, it is rebuilt once it degrades
+        std::vector<uint32_t> spheres;
+        for (uint32_t i = 0; i < s.entities.size(); ++i)
+        {
+            if (dynamic_cast<const Sphere*>(s.entities[i].get()))
+            {
+                spheres.push_back(i);
+            }
+        }
+        if (spheres.empty())
+        {
+            std::cerr << "The scene has no spheres to move\n";
+            return 1;
+        }
+        const size_t moved_per_frame = std::max<size_t>(1, spheres.size() / 100);
+        Rng rng(1);
+        double refit_seconds = 0.0;
+        int rebuilds = 0;
+        for (int frame = 0; frame < metasteps; ++frame)
+        {
+            std::vector<uint32_t> moved;
+            for (size_t i = 0; i < moved_per_frame; ++i)
+            {
+                const uint32_t index = spheres[rng.next() % spheres.size()];
+                auto &sphere = static_cast<Sphere&>(*s.entities[index]);
+                sphere.center += random_unit_sphere(rng) * sphere.radius;
+                moved.push_back(index);
+            }
+            const auto refit_start_time = std::chrono::steady_clock::now();
+            const bool rebuilt = s.refit(moved);
+            const std::chrono::duration<double> refit_time = std::chrono::steady_clock::now() - refit_start_time;
+            refit_seconds += refit_time.count();
+            rebuilds += rebuilt;
+            std::cout << "Frame " << frame << ": moved " << moved.size() << ", " << (rebuilt ? "rebuilt" : "refitted")
+                      << " in " << refit_time.count() * 1000.0 << "ms, SAH cost " << s.stats().sah_cost << "\n";
+        }
+        std::cout << metasteps << " frames updated in " << refit_seconds * 1000.0 << "ms with " << rebuilds
+                  << " rebuilds, a full build takes " << s.stats().build_seconds * 1000.0 << "ms\n";
+        return 0;
+    }
+    const CameraKey first_key = description.camera(0);
+    Camera camera(first_key.position, first_key.look_at, description.vertical_fov, static_cast<double>(width) / height);
 
     Image image;
     image.set_dimensions(width, height);
+    TemporalCache temporal_cache(temporal ? width : 0, temporal ? height : 0);
 
-    std::mutex counter_mutex;
-    std::mutex image_save_mutex;
-    std::vector<int> indices(width * height);
-    std::iota(indices.begin(), indices.end(), 0);
+    const TileScheduler scheduler(width, height, tile_size, tile_order);
+    // Finished frames are encoded in the background while the next one renders
+    FrameWriter writer(2, 1);
+    const std::string output_mode = argc > 1 ? argv[1] : "";
     for (int step = 0; step < steps; step++)
     {
         int metastep = step / substeps;
@@ -214,122 +349,237 @@ int main(const int argc, const char* argv[])
         std::cout << "Step: " << step << " Metastep: " << metastep << " Substep: " << substep << "\n";
         double f = metasteps < 2 ? 0.0f : static_cast<double>(metastep) / (metasteps - 1);
 
-        // double angle = lerp<double>(f, 45.0f, -315.0f) * M_PI / 180.0f;
-        // camera.transform = Vec3(cos(angle), 0.5 + 0.5 * sin(angle), sin(angle)) * 3;
-        camera.transform = lerp(f, Vec3(3), Vec3(0.0001));
+        const CameraKey key = description.camera(f);
+        camera.transform = key.position;
+        camera.look_at = key.look_at;
         camera.update();
+        if (temporal)
+        {
+            temporal_cache.beginFrame(camera);
+        }
+        const SamplerSettings sampler_settings(sampler_type, step, samples, width, height);
 
-        // Render image
-        int current = 0;
-        int last = 0;
-        double average_pixel_per_second = 0.0f;
-        static const double alpha = 0.1;
+        // Render image. The snapshots written while it progresses show the raw estimates, they are
+        // not denoised: pixels not yet rendered carry no guides and filtering would stall the render.
+        ProgressReporter progress(width * height, std::chrono::milliseconds(100), std::chrono::seconds(10), [&] {
+            Image temp_image = Image(image);
+            auto filepath = std::ostringstream();
+            filepath << "data/" << std::setfill('0') << std::setw(3) << step << ".png";
+            temp_image.post_process(1.0f, 2.0f);
+            temp_image.write_color_image(filepath.str());
+        });
         std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
-        std::transform(std::execution::par_unseq, indices.begin(), indices.end(), image.pixels.begin(), [&](int index) {
-            std::chrono::steady_clock::time_point pixel_start_time = std::chrono::steady_clock::now();
-            const int j = height - index / width;
-            const int i = index % width;
-            Vec3 c{0, 0, 0};
-            double t = 0;
-            for (int sample = 0; sample < samples; sample++)
+        // Starts pixel `index`, continuing the previous frame's estimate where it still applies
+        const auto start_pixel = [&](const int index) {
+            PixelJob job;
+            job.index = index;
+            job.j = height - index / width;
+            job.i = index % width;
+            if (temporal)
             {
-                HitData data;
-                const double u = float(i + random_unit()) / float(width);
-                const double v = float(j + random_unit()) / float(height);
-                const Ray r = camera.getRay(u, v);
-                c += castRay(r, s, 0, data);
-                t += data.t;
+                // The surface seen through the pixel center decides whether the previous estimate still applies
+                const Ray center_ray = camera.getRay((job.i + 0.5) / width, (job.j + 0.5) / height);
+                job.center_hit = s.hit(center_ray, RAY_T_MIN, RAY_T_MAX, job.center);
+                job.estimate = temporal_cache.reproject(center_ray.pointAt(job.center.t), job.center.normal, job.center_hit);
+                // Leave room below `samples` for the new samples every reused pixel traces
+                job.estimate.limit(std::min(temporal_history, samples - temporal_min_samples));
             }
-            t /= samples;
-            c /= samples;
-            const auto duration = std::chrono::steady_clock::now() - pixel_start_time;
+            job.history = job.estimate.samples();
+            return job;
+        };
+        // Number of samples the pixel traces next, 0 once it is done
+        const auto next_packet_size = [&](const PixelJob &job) {
+            const int min_new_samples = job.history > 0 ? temporal_min_samples : 0;
+            const int packet_size = use_packets ? PACKET_SIZE : 1;
+            if (job.sample < min_new_samples)
             {
-                counter_mutex.lock();
-                ++current;
-                if ((std::chrono::steady_clock::now() - last_update).count() / 1000000000.0f > .1f)
-                {
-                    const int64_t total = width * height;
-                    const double progress = (double)current / total;
-                    // const double pixel_per_second = (double)current / ((std::chrono::steady_clock::now() - start_time).count() / 1000000000.0f);
-                    const double pixel_per_second = (double) (current - last) / ((std::chrono::steady_clock::now() - last_update).count() / 1000000000.0f);
-                    average_pixel_per_second = alpha * pixel_per_second + (1.0f - alpha) * average_pixel_per_second;
-                    const double time_remaining = (total - current) / average_pixel_per_second;
-                    last_update = std::chrono::steady_clock::now();
-
-                    counter_mutex.unlock();
+                return std::min(min_new_samples - job.sample, packet_size);
+            }
+            if (job.history + job.sample >= samples)
+            {
+                return 0;
+            }
+            if (adaptive_threshold > 0 && job.history + job.sample >= min_samples && job.estimate.converged(adaptive_threshold))
+            {
+                return 0;
+            }
+            return std::min(packet_size, samples - job.history - job.sample);
+        };
+        const auto camera_rays = [&](const PixelJob &job, const int size, Ray *rays, Sampler *samplers) {
+            for (int lane = 0; lane < size; ++lane)
+            {
+                samplers[lane] = Sampler(sampler_settings, job.index, job.i, job.index / width, job.sample + lane);
+                double jitter_u, jitter_v;
+                samplers[lane].get2D(jitter_u, jitter_v);
+                const double u = float(job.i + jitter_u) / float(width);
+                const double v = float(job.j + jitter_v) / float(height);
+                rays[lane] = camera.getRay(u, v);
+            }
+        };
+        const auto finish_pixel = [&](const PixelJob &job, const int debug_counter) {
+            Pixel &pixel = image.pixels[job.index];
+            pixel.color = job.estimate.color();
+            pixel.depth = job.estimate.depth();
+            pixel.normal = job.estimate.normal();
+            pixel.albedo = job.estimate.albedo();
+            pixel.variance = job.estimate.variance();
+            // Only the samples traced in this frame, not those carried over
+            pixel.samples = job.estimate.samples() - job.history;
+            pixel.debug_counter = debug_counter;
+            if (temporal)
+            {
+                temporal_cache.store(job.index, job.estimate, job.center.t, job.center.normal, job.center_hit);
+            }
+        };
 
-                    std::cout << "\r" << std::fixed << std::setprecision(2);
-                    std::cout << (double)progress * 100.0f << "% "
-                              << "pps: " << average_pixel_per_second << " ETA: " << time_remaining << "s";
-                    std::cout << std::flush;
-                    last = current;
+        const auto render_pixel = [&](const int index) {
+            PixelJob job = start_pixel(index);
+            for (int size = next_packet_size(job); size > 0; size = next_packet_size(job))
+            {
+                Ray rays[PACKET_SIZE];
+                Sampler samplers[PACKET_SIZE];
+                camera_rays(job, size, rays, samplers);
+                if (use_packets)
+                {
+                    castPacket(rays, size, s, path_settings, samplers, job.estimate);
                 }
                 else
                 {
-                    counter_mutex.unlock();
+                    HitData data;
+                    const Vec3 color = castRay(rays[0], s, path_settings, 0, Vec3(1.0f), data, samplers[0]);
+                    add_sample(job.estimate, color, data, data.entity != nullptr, s);
                 }
+                job.sample += size;
             }
+            finish_pixel(job, hit_check_counter);
+            hit_check_counter = 0;
+        };
+
+        // Traces the packets of all pixels of a tile together, round by round, until every pixel is done
+        const auto render_tile_wavefront = [&](const Tile &tile) {
+            thread_local Wavefront wavefront;
+            std::vector<PixelJob> jobs;
+            for (int y = tile.y0; y < tile.y1; ++y)
             {
-                image_save_mutex.lock();
-                if ((std::chrono::steady_clock::now() - last_save).count() / 1000000000.0f > 10.0f)
+                for (int x = tile.x0; x < tile.x1; ++x)
                 {
-                    Image temp_image = Image(image);
-                    last_save = std::chrono::steady_clock::now();
-                    image_save_mutex.unlock();
-
-                    auto filepath = std::ostringstream();
-                    filepath << "data/" << std::setfill('0') << std::setw(3) << step << ".png";
-                    temp_image.post_process(1.0f, 2.0f);
-                    temp_image.write_color_image(filepath.str());
+                    jobs.push_back(start_pixel(y * width + x));
                 }
-                else
+            }
+            std::vector<int> sizes(jobs.size());
+            while (true)
+            {
+                wavefront.clear();
+                for (size_t job = 0; job < jobs.size(); ++job)
+                {
+                    sizes[job] = next_packet_size(jobs[job]);
+                    if (sizes[job] > 0)
+                    {
+                        Ray rays[PACKET_SIZE];
+                        Sampler samplers[PACKET_SIZE];
+                        camera_rays(jobs[job], sizes[job], rays, samplers);
+                        wavefront.addGroup(rays, samplers, sizes[job]);
+                    }
+                }
+                if (wavefront.size() == 0)
+                {
+                    break;
+                }
+                wavefront.trace(s, path_settings, use_packets);
+                size_t path = 0;
+                for (size_t job = 0; job < jobs.size(); ++job)
                 {
-                    image_save_mutex.unlock();
+                    for (int lane = 0; lane < sizes[job]; ++lane, ++path)
+                    {
+                        jobs[job].estimate.add(Vec3d(wavefront.color(path)), wavefront.depth(path),
+                                               Vec3d(wavefront.normal(path)), Vec3d(wavefront.albedo(path)));
+                    }
+                    jobs[job].sample += sizes[job];
                 }
             }
-            Pixel pixel;
-            pixel.color = c;
-            pixel.depth = t;
-            pixel.time = duration;
-            pixel.debug_counter = hit_check_counter;
+            // Traversal work is not attributed to single pixels here, every pixel reports the tile's average
+            const int debug_counter = hit_check_counter / tile.pixelCount();
             hit_check_counter = 0;
-            return pixel;
+            for (const PixelJob &job : jobs)
+            {
+                finish_pixel(job, debug_counter);
+            }
+        };
+
+        scheduler.run([&](const Tile &tile) {
+            std::chrono::steady_clock::time_point tile_start_time = std::chrono::steady_clock::now();
+            if (use_wavefront)
+            {
+                render_tile_wavefront(tile);
+            }
+            else
+            {
+                for (int y = tile.y0; y < tile.y1; ++y)
+                {
+                    for (int x = tile.x0; x < tile.x1; ++x)
+                    {
+                        render_pixel(y * width + x);
+                    }
+                }
+            }
+            // Pixels report the average time spent per pixel of their tile
+            const auto duration = (std::chrono::steady_clock::now() - tile_start_time) / tile.pixelCount();
+            for (int y = tile.y0; y < tile.y1; ++y)
+            {
+                for (int x = tile.x0; x < tile.x1; ++x)
+                {
+                    image.pixels[y * width + x].time = duration;
+                }
+            }
+
+            progress.add(tile.pixelCount());
         });
+        progress.finish();
 
         const double duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start_time).count() / 1000.0f;
 
-        std::cout << "\n" << "Total time: " << duration << "s\n";
+        int64_t total_samples = 0;
+        for (const auto &pixel : image.pixels)
+        {
+            total_samples += pixel.samples;
+        }
+        std::cout << "\n" << "Render time: " << duration << "s, "
+                  << static_cast<double>(total_samples) / image.pixels.size() << " samples per pixel\n";
 
         auto filepath = std::ostringstream();
         filepath << "data/" << std::setfill('0') << std::setw(3) << step << ".png";
 
-        std::cout << "Writing " << filepath.str() << "\n";
-        if (argc == 1)
-        {
-            image.post_process(1.0f, 2.0f);
-            image.write_color_image(filepath.str());
-        }
-        else
-        {
-            if (strcmp(argv[1], "depth") == 0)
+        // Hand the finished frame to the writer and render the next one into fresh pixels
+        Image frame = std::move(image);
+        image.set_dimensions(width, height);
+        writer.submit(filepath.str(), [frame = std::move(frame), path = filepath.str(), &output_mode, denoise]() mutable {
+            if (output_mode == "depth")
             {
-                image.write_depth_image(filepath.str(), 0);
+                return frame.write_depth_image(path, 0);
             }
-            else if (strcmp(argv[1], "time") == 0)
+            else if (output_mode == "time")
             {
-                image.write_time_image(filepath.str());
+                return frame.write_time_image(path);
             }
-            else if (strcmp(argv[1], "debug") == 0)
+            else if (output_mode == "debug")
             {
-                image.write_transform_image(filepath.str(), [](const Pixel &pixel) {
+                return frame.write_transform_image(path, [](const Pixel &pixel) {
                     return pixel.debug_counter;
                 }, 0);
             }
-            else
+            else if (output_mode == "samples")
             {
-                image.post_process(1.0f, 2.0f);
-                image.write_color_image(filepath.str());
+                return frame.write_transform_image(path, [](const Pixel &pixel) {
+                    return pixel.samples;
+                }, 0);
             }
-        }
+            if (denoise)
+            {
+                Denoiser().apply(frame);
+            }
+            frame.post_process(1.0f, 2.0f);
+            return frame.write_color_image(path);
+        });
     }
+    writer.finish();
 }
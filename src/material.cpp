@@ -0,0 +1,48 @@
+#include "material.hpp"
+
+Material Material::lambertian(const Vec3 &albedo)
+{
+    return {MaterialType::LAMBERTIAN, Vec3(0.0f), Vec3(0.0f), albedo, Vec3(0.0f), 1.0f};
+}
+
+Material Material::metal(const Vec3 &albedo)
+{
+    return {MaterialType::METAL, Vec3(0.0f), Vec3(0.0f), albedo, Vec3(0.0f), 0.0f};
+}
+
+Material Material::physics(const Vec3 &diffuse, const Vec3 &reflective, const Real roughness)
+{
+    return {MaterialType::PHYSICS, diffuse * 0.1f, diffuse, reflective, Vec3(0.0f), roughness};
+}
+
+bool Material::scatters() const
+{
+    return reflective[0] > 0 || reflective[1] > 0 || reflective[2] > 0;
+}
+
+bool Material::scatter(const Ray& r, const HitData &data, Vec3 &attenuation, Ray &scattered, Sampler &sampler) const
+{
+    switch (type)
+    {
+        case MaterialType::LAMBERTIAN:
+        {
+            const Vec3 target = data.hit_point + data.normal + sample_unit_ball(sampler);
+            scattered = Ray(data.hit_point, target - data.hit_point);
+            break;
+        }
+        case MaterialType::METAL:
+        {
+            const Vec3 target_direction = data.normal.reflect(r.direction().normalized());
+            scattered = Ray(data.hit_point, target_direction);
+            break;
+        }
+        case MaterialType::PHYSICS:
+        {
+            const Vec3 target_direction = (data.normal + sample_unit_ball(sampler) * roughness).reflect(r.direction().normalized());
+            scattered = Ray(data.hit_point, target_direction);
+            break;
+        }
+    }
+    attenuation = reflective;
+    return true;
+}
@@ -2,9 +2,37 @@
 
 #include "entity.hpp"
 #include "ray.hpp"
+#include "sampler.hpp"
 
-class Material
+enum class MaterialType : uint32_t
 {
-    public:
-        virtual bool scatter(const Ray& r, const HitData &data, Vec3 &attenuation, Ray &scattered) const = 0;
+    // Scatters in a random direction around the normal
+    LAMBERTIAN,
+    // Mirror reflection
+    METAL,
+    // Rough reflection with direct lighting, ambient and emissive terms
+    PHYSICS
+};
+
+// All materials share one flat layout so the scene keeps them in a single contiguous table and
+// shading dispatches on `type` instead of through a vtable.
+struct Material
+{
+    static Material lambertian(const Vec3 &albedo);
+    static Material metal(const Vec3 &albedo);
+    static Material physics(const Vec3 &diffuse, const Vec3 &reflective, const Real roughness);
+
+    // Picks the next ray direction. `attenuation` scales the light arriving along `scattered`.
+    bool scatter(const Ray& r, const HitData &data, Vec3 &attenuation, Ray &scattered, Sampler &sampler) const;
+    // False if scattered rays carry no light back, so they need not be traced
+    bool scatters() const;
+
+    MaterialType type;
+    Vec3 ambient;
+    // Reflectance of direct light from the sun and emissive entities
+    Vec3 diffuse;
+    // Reflectance of the scattered ray
+    Vec3 reflective;
+    Vec3 emissive;
+    Real roughness;
 };
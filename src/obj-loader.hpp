@@ -0,0 +1,113 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "triangle-mesh.hpp"
+
+// Reads the vertices and faces of a Wavefront OBJ file line by line and builds the mesh tree.
+// Faces may use any of the v, v/vt, v//vn and v/vt/vn forms and negative (relative) indices,
+// polygons are split into triangle fans. Texture coordinates, normals, groups and materials are
+// skipped, meshes are shaded with their face normals.
+bool load_obj(const std::string &path, MeshData &mesh)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        std::cerr << "Failed to open " << path << "\n";
+        return false;
+    }
+
+    const auto start_time = std::chrono::steady_clock::now();
+    mesh = MeshData();
+    std::vector<Vec3f> positions;
+    std::vector<uint32_t> indices;
+    std::vector<uint32_t> polygon;
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line))
+    {
+        line_number++;
+        const char *p = line.c_str();
+        while (std::isspace(static_cast<unsigned char>(*p)))
+        {
+            p++;
+        }
+
+        bool valid = true;
+        const char *element = p[0] == 'v' ? "vertex" : "face";
+        if (p[0] == 'v' && std::isspace(static_cast<unsigned char>(p[1])))
+        {
+            char *end = nullptr;
+            Vec3f position;
+            p++;
+            for (int i = 0; i < 3 && valid; ++i)
+            {
+                position[i] = std::strtof(p, &end);
+                valid = end != p;
+                p = end;
+            }
+            positions.push_back(position);
+        }
+        else if (p[0] == 'f' && std::isspace(static_cast<unsigned char>(p[1])))
+        {
+            polygon.clear();
+            p++;
+            while (valid)
+            {
+                char *end = nullptr;
+                const long index = std::strtol(p, &end, 10);
+                if (end == p)
+                {
+                    break;
+                }
+                const long vertex_count = static_cast<long>(positions.size());
+                const long vertex = index < 0 ? vertex_count + index : index - 1;
+                valid = index != 0 && vertex >= 0 && vertex < vertex_count;
+                polygon.push_back(static_cast<uint32_t>(vertex));
+                // Skip the texture coordinate and normal references
+                p = end;
+                while (*p && !std::isspace(static_cast<unsigned char>(*p)))
+                {
+                    p++;
+                }
+            }
+            valid = valid && polygon.size() >= 3;
+            for (size_t i = 2; valid && i < polygon.size(); ++i)
+            {
+                indices.insert(indices.end(), {polygon[0], polygon[i - 1], polygon[i]});
+            }
+        }
+
+        if (!valid)
+        {
+            std::cerr << path << ":" << line_number << ": invalid " << element << "\n";
+            return false;
+        }
+    }
+    if (indices.empty())
+    {
+        std::cerr << path << " contains no faces\n";
+        return false;
+    }
+    mesh.positions = std::move(positions);
+    mesh.indices = std::move(indices);
+
+    const auto build_start_time = std::chrono::steady_clock::now();
+    mesh.build();
+    const auto end_time = std::chrono::steady_clock::now();
+    const std::chrono::duration<double> load_time = build_start_time - start_time;
+    const std::chrono::duration<double> build_time = end_time - build_start_time;
+    std::cout << "Loaded " << path << ": " << mesh.positions.size() << " vertices, " << mesh.triangleCount()
+              << " triangles in " << load_time.count() * 1000.0 << "ms, tree " << build_time.count() * 1000.0
+              << "ms, " << mesh.memoryUsage() / mesh.triangleCount() << " bytes per triangle\n";
+    return true;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+
+#include "vec3.hpp"
+
+// Accumulates the samples of one pixel. Besides the color sum it keeps a running mean and
+// variance of the sample luminance (Welford), which tells how far the estimate can still be off.
+// The normal and albedo of the first hit are averaged as well to guide the denoiser.
+class PixelEstimate
+{
+    public:
+        void add(const Vec3d &color, const double depth, const Vec3d &normal, const Vec3d &albedo);
+
+        int samples() const { return samples_; }
+        Vec3d color() const { return colorSum_ / samples_; }
+        double depth() const { return depthSum_ / samples_; }
+        Vec3d normal() const { return normalSum_ / samples_; }
+        Vec3d albedo() const { return albedoSum_ / samples_; }
+        // Variance of the mean luminance. With a single sample it is taken to be as large as the mean itself.
+        double variance() const;
+        // Half width of the 95% confidence interval of the mean luminance
+        double error() const;
+        // True once the error is below `threshold` relative to the mean luminance. Dark pixels are
+        // measured against a small absolute floor so they don't soak up samples for invisible noise.
+        bool converged(const double threshold) const;
+        // Scales the accumulated samples down to a weight of `max_samples`, keeping mean and variance,
+        // so samples carried over from earlier frames fade out
+        void limit(const int max_samples);
+
+    private:
+        static constexpr double CONFIDENCE_Z = 1.96;
+        static constexpr double LUMINANCE_FLOOR = 0.01;
+
+        int samples_ = 0;
+        Vec3d colorSum_;
+        double depthSum_ = 0.0;
+        Vec3d normalSum_;
+        Vec3d albedoSum_;
+        double luminanceMean_ = 0.0;
+        double luminanceM2_ = 0.0;
+};
+
+inline double luminance(const Vec3d &color)
+{
+    return 0.2126 * color.r() + 0.7152 * color.g() + 0.0722 * color.b();
+}
+
+void PixelEstimate::add(const Vec3d &color, const double depth, const Vec3d &normal, const Vec3d &albedo)
+{
+    samples_++;
+    colorSum_ += color;
+    depthSum_ += depth;
+    normalSum_ += normal;
+    albedoSum_ += albedo;
+
+    const double value = luminance(color);
+    const double delta = value - luminanceMean_;
+    luminanceMean_ += delta / samples_;
+    luminanceM2_ += delta * (value - luminanceMean_);
+}
+
+double PixelEstimate::error() const
+{
+    if (samples_ < 2)
+    {
+        return INFINITY;
+    }
+    return CONFIDENCE_Z * std::sqrt(variance());
+}
+
+double PixelEstimate::variance() const
+{
+    if (samples_ < 2)
+    {
+        return luminanceMean_ * luminanceMean_;
+    }
+    return luminanceM2_ / (samples_ - 1) / samples_;
+}
+
+bool PixelEstimate::converged(const double threshold) const
+{
+    return error() <= threshold * std::max(luminanceMean_, LUMINANCE_FLOOR);
+}
+
+void PixelEstimate::limit(const int max_samples)
+{
+    if (samples_ <= max_samples)
+    {
+        return;
+    }
+    const double scale = static_cast<double>(max_samples) / samples_;
+    colorSum_ *= scale;
+    depthSum_ *= scale;
+    normalSum_ *= scale;
+    albedoSum_ *= scale;
+    luminanceM2_ *= static_cast<double>(max_samples - 1) / (samples_ - 1);
+    samples_ = max_samples;
+}
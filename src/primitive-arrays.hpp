@@ -0,0 +1,342 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <vector>
+
+#include "box.hpp"
+#include "entity.hpp"
+#include "kdtree-node.hpp"
+#include "ray-packet.hpp"
+#include "shared-array.hpp"
+#include "simd.hpp"
+#include "sphere.hpp"
+
+// Geometry of the tree's primitives as structure of arrays, indexed by position in the primitive
+// index array. Every leaf lists its spheres first, then its boxes, then entities of any other type,
+// so the spheres and boxes of a leaf are tested PACKET_SIZE at a time without touching the entities.
+// Sphere and Box objects remain the interface for setting up a scene, the arrays are copied from
+// them whenever the tree is rebuilt.
+class PrimitiveArrays
+{
+    public:
+        // Groups the primitives of every leaf by type and copies their geometry
+        void build(const std::vector<std::shared_ptr<Entity>> &entities, const SharedArray<KDN> &nodes,
+                   SharedArray<uint32_t> &primitive_indices);
+
+        // Copies the geometry of the primitive at `position` again after it moved
+        void refresh(const uint32_t position);
+
+        // Finds the closest hit among the primitives of `leaf` and shrinks ray.t_max to it
+        bool intersect(TraversalRay &ray, const KDN &leaf, HitData &data) const;
+        // Returns the position of a primitive of `leaf` that blocks the ray, or -1 if there is none
+        int64_t occluder(const TraversalRay &ray, const KDN &leaf) const;
+        // Intersects the active lanes of a packet with the primitives of `leaf`, like Entity::hitPacket
+        PacketMask hitPacket(const RayPacket &packet, const KDN &leaf, const PacketMask &active, const Real t_min,
+                             PacketReal &closest, HitPacket &data) const;
+
+    private:
+        enum Type : uint8_t
+        {
+            SPHERE,
+            BOX,
+            OTHER
+        };
+
+        static Type typeOf(const Entity *entity);
+        void copyGeometry(const uint32_t position, const Type type);
+
+        // Number of spheres and boxes a leaf starts with, stored at the leaf's offset
+        struct LeafTypes
+        {
+            uint16_t spheres;
+            uint16_t boxes;
+        };
+
+        // Test one ray against the PACKET_SIZE spheres or boxes from `first` on, of which the first
+        // `count` belong to the leaf. Return the lanes hit within the ray interval and their distance.
+        PacketMask intersectSpheres(const TraversalRay &ray, const uint32_t first, const int count, PacketReal &t) const;
+        PacketMask intersectBoxes(const TraversalRay &ray, const uint32_t first, const int count, PacketReal &t) const;
+        // Keeps the closest of the lanes hit, returns false if there is none
+        bool closestHit(TraversalRay &ray, const PacketMask &hits, const PacketReal &t, const uint32_t first,
+                        HitData &data) const;
+        void recordHits(const PacketMask &hits, const PacketReal &t, const uint32_t position,
+                        PacketReal &closest, HitPacket &data) const;
+
+        std::vector<LeafTypes> leafTypes_;
+        std::vector<const Entity*> entities_;
+        // Padded by PACKET_SIZE so batches at the end of the array can load whole vectors
+        std::vector<Real> sphereCenter_[3];
+        std::vector<Real> sphereRadius_;
+        std::vector<Real> boxLow_[3];
+        std::vector<Real> boxHigh_[3];
+};
+
+void PrimitiveArrays::build(const std::vector<std::shared_ptr<Entity>> &entities, const SharedArray<KDN> &nodes,
+                            SharedArray<uint32_t> &primitive_indices)
+{
+    const size_t size = primitive_indices.size();
+    std::vector<Type> entity_types(entities.size());
+    for (size_t i = 0; i < entities.size(); ++i)
+    {
+        entity_types[i] = typeOf(entities[i].get());
+    }
+    const auto type_of = [&](const uint32_t index) { return entity_types[index]; };
+
+    leafTypes_.assign(size, {0, 0});
+    for (const KDN &node : nodes)
+    {
+        if (!node.isLeaf())
+        {
+            continue;
+        }
+        const auto first = primitive_indices.begin() + node.offset;
+        const auto last = first + node.count;
+        const auto by_type = [&](const uint32_t a, const uint32_t b) { return type_of(a) < type_of(b); };
+        // Trees loaded from a compiled scene are already grouped, sorting them anyway would copy mapped pages
+        if (!std::is_sorted(first, last, by_type))
+        {
+            std::stable_sort(first, last, by_type);
+        }
+        LeafTypes &leaf_types = leafTypes_[node.offset];
+        leaf_types.spheres = std::count_if(first, last, [&](const uint32_t index) { return type_of(index) == SPHERE; });
+        leaf_types.boxes = std::count_if(first, last, [&](const uint32_t index) { return type_of(index) == BOX; });
+    }
+
+    const size_t padded = size + PACKET_SIZE;
+    entities_.assign(size, nullptr);
+    sphereRadius_.assign(padded, 0.0);
+    for (int i = 0; i < 3; ++i)
+    {
+        sphereCenter_[i].assign(padded, 0.0);
+        boxLow_[i].assign(padded, 0.0);
+        boxHigh_[i].assign(padded, 0.0);
+    }
+    for (size_t position = 0; position < size; ++position)
+    {
+        entities_[position] = entities[primitive_indices[position]].get();
+        copyGeometry(position, type_of(primitive_indices[position]));
+    }
+}
+
+void PrimitiveArrays::refresh(const uint32_t position)
+{
+    copyGeometry(position, typeOf(entities_[position]));
+}
+
+PrimitiveArrays::Type PrimitiveArrays::typeOf(const Entity *entity)
+{
+    return dynamic_cast<const Sphere*>(entity) ? SPHERE : dynamic_cast<const Box*>(entity) ? BOX : OTHER;
+}
+
+void PrimitiveArrays::copyGeometry(const uint32_t position, const Type type)
+{
+    if (type == SPHERE)
+    {
+        const auto *sphere = static_cast<const Sphere*>(entities_[position]);
+        for (int i = 0; i < 3; ++i)
+        {
+            sphereCenter_[i][position] = sphere->center[i];
+        }
+        sphereRadius_[position] = sphere->radius;
+    }
+    else if (type == BOX)
+    {
+        const auto *box = static_cast<const Box*>(entities_[position]);
+        for (int i = 0; i < 3; ++i)
+        {
+            boxLow_[i][position] = box->boundingBox.low[i];
+            boxHigh_[i][position] = box->boundingBox.high[i];
+        }
+    }
+}
+
+bool PrimitiveArrays::intersect(TraversalRay &ray, const KDN &leaf, HitData &data) const
+{
+    const LeafTypes types = leafTypes_[leaf.offset];
+    const uint32_t boxes = leaf.offset + types.spheres;
+    const uint32_t others = boxes + types.boxes;
+    const uint32_t end = leaf.offset + leaf.count;
+
+    bool found = false;
+    PacketReal t = {};
+    for (uint32_t first = leaf.offset; first < boxes; first += PACKET_SIZE)
+    {
+        found |= closestHit(ray, intersectSpheres(ray, first, boxes - first, t), t, first, data);
+    }
+    for (uint32_t first = boxes; first < others; first += PACKET_SIZE)
+    {
+        found |= closestHit(ray, intersectBoxes(ray, first, others - first, t), t, first, data);
+    }
+    for (uint32_t position = others; position < end; ++position)
+    {
+        if (entities_[position]->intersect(ray, data))
+        {
+            ray.t_max = data.t;
+            found = true;
+        }
+    }
+    return found;
+}
+
+int64_t PrimitiveArrays::occluder(const TraversalRay &ray, const KDN &leaf) const
+{
+    const LeafTypes types = leafTypes_[leaf.offset];
+    const uint32_t boxes = leaf.offset + types.spheres;
+    const uint32_t others = boxes + types.boxes;
+    const uint32_t end = leaf.offset + leaf.count;
+
+    PacketReal t = {};
+    for (uint32_t first = leaf.offset; first < boxes; first += PACKET_SIZE)
+    {
+        const int lane = Simd::first_set(intersectSpheres(ray, first, boxes - first, t));
+        if (lane >= 0)
+        {
+            return first + lane;
+        }
+    }
+    for (uint32_t first = boxes; first < others; first += PACKET_SIZE)
+    {
+        const int lane = Simd::first_set(intersectBoxes(ray, first, others - first, t));
+        if (lane >= 0)
+        {
+            return first + lane;
+        }
+    }
+    for (uint32_t position = others; position < end; ++position)
+    {
+        if (entities_[position]->occludes(ray))
+        {
+            return position;
+        }
+    }
+    return -1;
+}
+
+PacketMask PrimitiveArrays::hitPacket(const RayPacket &packet, const KDN &leaf, const PacketMask &active,
+                                      const Real t_min, PacketReal &closest, HitPacket &data) const
+{
+    const LeafTypes types = leafTypes_[leaf.offset];
+    const uint32_t boxes = leaf.offset + types.spheres;
+    const uint32_t others = boxes + types.boxes;
+    const uint32_t end = leaf.offset + leaf.count;
+
+    // The packet already fills the vector lanes, so primitives are tested one at a time here
+    PacketMask hits = {};
+    PacketReal t = {};
+    for (uint32_t position = leaf.offset; position < boxes; ++position)
+    {
+        const Vec3 center(sphereCenter_[0][position], sphereCenter_[1][position], sphereCenter_[2][position]);
+        const PacketMask lane_hits = sphere_packet_test(packet, active, t_min, closest, center,
+                                                        sphereRadius_[position], t);
+        recordHits(lane_hits, t, position, closest, data);
+        hits |= lane_hits;
+    }
+    for (uint32_t position = boxes; position < others; ++position)
+    {
+        const Vec3 low(boxLow_[0][position], boxLow_[1][position], boxLow_[2][position]);
+        const Vec3 high(boxHigh_[0][position], boxHigh_[1][position], boxHigh_[2][position]);
+        const PacketMask lane_hits = box_packet_test(packet, active, t_min, closest, low, high, t);
+        recordHits(lane_hits, t, position, closest, data);
+        hits |= lane_hits;
+    }
+    for (uint32_t position = others; position < end; ++position)
+    {
+        hits |= entities_[position]->hitPacket(packet, active, t_min, closest, data);
+    }
+    return hits;
+}
+
+PacketMask PrimitiveArrays::intersectSpheres(const TraversalRay &ray, const uint32_t first, const int count,
+                                             PacketReal &t) const
+{
+    // Same arithmetic as Sphere::intersect, with one sphere per lane
+    const Vec3 direction = ray.ray.direction();
+    const Real a = direction.dot(direction);
+    const PacketReal ocx = ray.origin[0] - Simd::load(&sphereCenter_[0][first]);
+    const PacketReal ocy = ray.origin[1] - Simd::load(&sphereCenter_[1][first]);
+    const PacketReal ocz = ray.origin[2] - Simd::load(&sphereCenter_[2][first]);
+    const PacketReal radius = Simd::load(&sphereRadius_[first]);
+    const PacketReal b = ocx * direction[0] + ocy * direction[1] + ocz * direction[2];
+    const PacketReal c = ocx * ocx + ocy * ocy + ocz * ocz - radius * radius;
+    const PacketReal discriminator = b * b - a * c;
+    const PacketMask valid = Simd::first_lanes(count) & (discriminator > 0.0);
+    if (!Simd::any(valid))
+    {
+        return valid;
+    }
+
+    const PacketReal intersectionLength = Simd::sqrt(Simd::max(discriminator, Simd::broadcast(0.0))) / a;
+    const PacketReal bdiva = b / a;
+    const PacketReal near = -bdiva - intersectionLength;
+    const PacketReal far = -bdiva + intersectionLength;
+    const PacketReal lower = Simd::broadcast(ray.t_min);
+    const PacketReal upper = Simd::broadcast(ray.t_max);
+    const PacketMask nearInside = (near < upper) & (near > lower);
+    const PacketMask farInside = (far < upper) & (far > lower);
+    t = Simd::select(nearInside, near, far);
+    return valid & (nearInside | farInside);
+}
+
+PacketMask PrimitiveArrays::intersectBoxes(const TraversalRay &ray, const uint32_t first, const int count,
+                                           PacketReal &t) const
+{
+    // Same arithmetic as Box::intersect, with one box per lane
+    PacketReal t_enter = Simd::broadcast(-std::numeric_limits<Real>::infinity());
+    PacketReal t_exit = Simd::broadcast(std::numeric_limits<Real>::infinity());
+    for (int i = 0; i < 3; ++i)
+    {
+        const std::vector<Real> &near_bounds = ray.sign[i] ? boxHigh_[i] : boxLow_[i];
+        const std::vector<Real> &far_bounds = ray.sign[i] ? boxLow_[i] : boxHigh_[i];
+        const PacketReal near = (Simd::load(&near_bounds[first]) - ray.origin[i]) * ray.inverse_direction[i];
+        const PacketReal far = (Simd::load(&far_bounds[first]) - ray.origin[i]) * ray.inverse_direction[i];
+        t_enter = Simd::select(t_enter < near, near, t_enter);
+        t_exit = Simd::select(far < t_exit, far, t_exit);
+    }
+
+    const PacketReal lower = Simd::broadcast(ray.t_min);
+    const PacketReal upper = Simd::broadcast(ray.t_max);
+    t = Simd::select(t_enter >= lower, t_enter, t_exit);
+    return Simd::first_lanes(count) & ~((t_enter > t_exit) | (t < lower) | (t > upper));
+}
+
+bool PrimitiveArrays::closestHit(TraversalRay &ray, const PacketMask &hits, const PacketReal &t, const uint32_t first,
+                                 HitData &data) const
+{
+    int closest = -1;
+    for (int lane = 0; lane < PACKET_SIZE; ++lane)
+    {
+        if (hits[lane] && (closest < 0 || t[lane] < t[closest]))
+        {
+            closest = lane;
+        }
+    }
+    if (closest < 0)
+    {
+        return false;
+    }
+    ray.t_max = t[closest];
+    data.t = t[closest];
+    data.entity = entities_[first + closest];
+    return true;
+}
+
+void PrimitiveArrays::recordHits(const PacketMask &hits, const PacketReal &t, const uint32_t position,
+                                 PacketReal &closest, HitPacket &data) const
+{
+    if (!Simd::any(hits))
+    {
+        return;
+    }
+    closest = Simd::select(hits, t, closest);
+    for (int lane = 0; lane < PACKET_SIZE; ++lane)
+    {
+        if (hits[lane])
+        {
+            data[lane].t = t[lane];
+            data[lane].entity = entities_[position];
+        }
+    }
+}
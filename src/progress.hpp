@@ -0,0 +1,143 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include <tbb/task_arena.h>
+
+// Counts rendered pixels without ever blocking the workers. Every worker adds to its own
+// cache-line sized counter with relaxed atomics; a reporter thread sums them at a fixed interval,
+// prints pixels per second and the ETA, and periodically calls the snapshot callback.
+class ProgressReporter
+{
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        ProgressReporter(const int64_t total, const Clock::duration report_interval,
+                         const Clock::duration snapshot_interval, std::function<void()> snapshot);
+        ~ProgressReporter();
+
+        void add(const int64_t pixels);
+        int64_t completed() const;
+        // Stops the reporter thread and prints the final state
+        void finish();
+
+    private:
+        struct alignas(64) Counter
+        {
+            std::atomic<int64_t> pixels{0};
+        };
+
+        void run();
+        void report(const double pixel_per_second) const;
+
+        const int64_t total_;
+        const Clock::duration reportInterval_;
+        const Clock::duration snapshotInterval_;
+        std::function<void()> snapshot_;
+        std::vector<Counter> counters_;
+
+        std::mutex mutex_;
+        std::condition_variable wake_;
+        bool stop_ = false;
+        std::thread thread_;
+};
+
+ProgressReporter::ProgressReporter(const int64_t total, const Clock::duration report_interval,
+                                   const Clock::duration snapshot_interval, std::function<void()> snapshot)
+    : total_(total)
+    , reportInterval_(report_interval)
+    , snapshotInterval_(snapshot_interval)
+    , snapshot_(std::move(snapshot))
+    , counters_(tbb::this_task_arena::max_concurrency() + 1)
+{
+    thread_ = std::thread([this] { run(); });
+}
+
+ProgressReporter::~ProgressReporter()
+{
+    finish();
+}
+
+void ProgressReporter::add(const int64_t pixels)
+{
+    // Threads outside the arena share the last counter
+    const int index = tbb::this_task_arena::current_thread_index();
+    const size_t slot = index >= 0 ? static_cast<size_t>(index) % (counters_.size() - 1) : counters_.size() - 1;
+    counters_[slot].pixels.fetch_add(pixels, std::memory_order_relaxed);
+}
+
+int64_t ProgressReporter::completed() const
+{
+    int64_t sum = 0;
+    for (const auto &counter : counters_)
+    {
+        sum += counter.pixels.load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+void ProgressReporter::finish()
+{
+    if (!thread_.joinable())
+    {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    thread_.join();
+}
+
+void ProgressReporter::report(const double pixel_per_second) const
+{
+    const int64_t current = completed();
+    const double progress = static_cast<double>(current) / total_;
+    const double time_remaining = pixel_per_second > 0.0 ? (total_ - current) / pixel_per_second : 0.0;
+    std::cout << "\r" << std::fixed << std::setprecision(2);
+    std::cout << progress * 100.0f << "% "
+              << "pps: " << pixel_per_second << " ETA: " << time_remaining << "s";
+    std::cout << std::flush;
+}
+
+void ProgressReporter::run()
+{
+    static const double alpha = 0.1;
+    double average_pixel_per_second = 0.0;
+    int64_t last = 0;
+    Clock::time_point last_update = Clock::now();
+    Clock::time_point last_snapshot = last_update;
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!wake_.wait_for(lock, reportInterval_, [this] { return stop_; }))
+    {
+        const Clock::time_point now = Clock::now();
+        const int64_t current = completed();
+        const double seconds = std::chrono::duration<double>(now - last_update).count();
+        const double pixel_per_second = (current - last) / seconds;
+        average_pixel_per_second = last == 0 && average_pixel_per_second == 0.0
+            ? pixel_per_second
+            : alpha * pixel_per_second + (1.0 - alpha) * average_pixel_per_second;
+        last = current;
+        last_update = now;
+        report(average_pixel_per_second);
+
+        if (snapshot_ && now - last_snapshot > snapshotInterval_)
+        {
+            snapshot_();
+            last_snapshot = Clock::now();
+        }
+    }
+    report(average_pixel_per_second);
+}
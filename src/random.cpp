@@ -1,24 +1,71 @@
 #include "random.hpp"
 
-std::random_device random_device;
-std::uniform_real_distribution<double> distribution(0.0f, 1.0f);
-std::mt19937 random_generator(random_device());
+#include <algorithm>
+#include <cmath>
 
-double random_unit()
+uint64_t mix_bits(uint64_t x)
 {
-    return distribution(random_generator);
+    // splitmix64 finalizer
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
 }
 
-Vec3 random_unit_cube()
+Rng::Rng(const uint64_t seed, const uint64_t stream)
+    : state_(0)
+    , increment_((stream << 1) | 1)
 {
-    return Vec3(distribution(random_generator), distribution(random_generator), distribution(random_generator));
+    next();
+    state_ += seed;
+    next();
 }
 
-Vec3 random_unit_sphere()
+Rng::Rng(const uint64_t frame, const uint64_t pixel, const uint64_t sample)
+    : Rng(mix_bits(mix_bits(frame) ^ sample), mix_bits(pixel))
 {
-    Vec3 p;
-    do {
-        p = 2.0*Vec3(distribution(random_generator), distribution(random_generator), distribution(random_generator)) - Vec3(1,1,1);
-    } while (p.squaredLength() >= 1.0f);
-    return p;
+}
+
+uint32_t Rng::next()
+{
+    const uint64_t old_state = state_;
+    state_ = old_state * 6364136223846793005ULL + increment_;
+    const auto xorshifted = static_cast<uint32_t>(((old_state >> 18) ^ old_state) >> 27);
+    const auto rotation = static_cast<uint32_t>(old_state >> 59);
+    return (xorshifted >> rotation) | (xorshifted << ((-rotation) & 31));
+}
+
+double Rng::unit()
+{
+    const uint64_t bits = (static_cast<uint64_t>(next()) << 32) | next();
+    return static_cast<double>(bits >> 11) * 0x1.0p-53;
+}
+
+double random_unit(Rng &rng)
+{
+    return rng.unit();
+}
+
+Vec3 random_unit_cube(Rng &rng)
+{
+    const double x = rng.unit();
+    const double y = rng.unit();
+    const double z = rng.unit();
+    return Vec3(x, y, z);
+}
+
+Vec3 random_unit_sphere(Rng &rng)
+{
+    const double u = rng.unit();
+    const double v = rng.unit();
+    return unit_ball(u, v, rng.unit());
+}
+
+Vec3 unit_ball(const double u, const double v, const double w)
+{
+    // A uniform direction scaled by the cube root of w, since the volume within radius r grows as r^3
+    const double z = 1.0 - 2.0 * u;
+    const double ring = std::sqrt(std::max(0.0, 1.0 - z * z));
+    const double phi = 2.0 * M_PI * v;
+    return Vec3(ring * std::cos(phi), ring * std::sin(phi), z) * std::cbrt(w);
 }
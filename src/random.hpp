@@ -1,9 +1,32 @@
 #pragma once
 
-#include <random>
+#include <cstdint>
 
 #include "vec3.hpp"
 
-double random_unit();
-Vec3 random_unit_cube();
-Vec3 random_unit_sphere();
+// PCG32 generator. Every camera sample seeds its own instance from (frame, pixel, sample),
+// so workers never share generator state and renders do not depend on the thread count.
+class Rng
+{
+    public:
+        explicit Rng(const uint64_t seed = 0, const uint64_t stream = 0);
+        Rng(const uint64_t frame, const uint64_t pixel, const uint64_t sample);
+
+        uint32_t next();
+        // Uniform double in [0, 1)
+        double unit();
+
+    private:
+        uint64_t state_;
+        uint64_t increment_;
+};
+
+// Scrambles the bits of `x` (the splitmix64 finalizer), for deriving seeds
+uint64_t mix_bits(uint64_t x);
+
+double random_unit(Rng &rng);
+Vec3 random_unit_cube(Rng &rng);
+// Uniform point within the unit ball
+Vec3 random_unit_sphere(Rng &rng);
+// Maps three uniform numbers in [0, 1) onto a uniform point within the unit ball, without rejection
+Vec3 unit_ball(const double u, const double v, const double w);
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <array>
+#include <limits>
+
+#include "ray.hpp"
+#include "simd.hpp"
+
+// Up to PACKET_SIZE rays stored lane-wise for SIMD traversal. Unused lanes are inactive.
+struct RayPacket
+{
+    RayPacket(const Ray *first, const int size);
+
+    // True if all active rays point into the same octant, so they agree on the child order
+    bool coherent() const;
+
+    std::array<Ray, PACKET_SIZE> rays;
+    PacketReal origin[3];
+    PacketReal direction[3];
+    PacketReal inverse_direction[3];
+    PacketMask active;
+    int size;
+};
+
+// Lane-wise version of the slab test in ray.hpp
+template <typename Bounds>
+inline void slab_test(const RayPacket &packet, const Bounds &low, const Bounds &high,
+                      PacketReal &t_enter, PacketReal &t_exit)
+{
+    t_enter = Simd::broadcast(-std::numeric_limits<Real>::infinity());
+    t_exit = Simd::broadcast(std::numeric_limits<Real>::infinity());
+    for (int i = 0; i < 3; ++i)
+    {
+        const PacketReal t0 = (low[i] - packet.origin[i]) * packet.inverse_direction[i];
+        const PacketReal t1 = (high[i] - packet.origin[i]) * packet.inverse_direction[i];
+        const PacketReal near = Simd::min(t0, t1);
+        const PacketReal far = Simd::max(t0, t1);
+        t_enter = Simd::select(near > t_enter, near, t_enter);
+        t_exit = Simd::select(far < t_exit, far, t_exit);
+    }
+}
+
+inline RayPacket::RayPacket(const Ray *first, const int size)
+    : size(size)
+{
+    for (int lane = 0; lane < PACKET_SIZE; ++lane)
+    {
+        // Inactive lanes repeat the first ray to keep their arithmetic well defined
+        rays[lane] = first[lane < size ? lane : 0];
+        const Vec3 o = rays[lane].origin();
+        const Vec3 d = rays[lane].direction();
+        for (int i = 0; i < 3; ++i)
+        {
+            origin[i][lane] = o[i];
+            direction[i][lane] = d[i];
+            inverse_direction[i][lane] = 1.0 / d[i];
+        }
+        active[lane] = lane < size ? -1 : 0;
+    }
+}
+
+inline bool RayPacket::coherent() const
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        const PacketMask positive = direction[i] > 0;
+        if (Simd::any(active & positive) && Simd::any(active & ~positive))
+        {
+            return false;
+        }
+    }
+    return true;
+}
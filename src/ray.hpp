@@ -1,5 +1,9 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <limits>
+
 #include "vec3.hpp"
 
 class Ray
@@ -10,10 +14,55 @@ class Ray
 
         Vec3 origin() const { return origin_; }
         Vec3 direction() const { return direction_; }
-        Vec3 pointAt(const double t) const { return origin_ + direction_ * t; }
+        Vec3 pointAt(const Real t) const { return origin_ + direction_ * t; }
 
     private:
         Vec3 origin_;
         Vec3 direction_;
 
 };
+
+// Ray as seen during traversal: the inverse direction and its signs are computed once per query
+// and [t_min, t_max] is the interval still worth searching, t_max shrinks to the closest hit.
+struct TraversalRay
+{
+    TraversalRay(const Ray &ray, const Real t_min, const Real t_max);
+
+    Ray ray;
+    Vec3 origin;
+    Vec3 inverse_direction;
+    std::array<int, 3> sign;
+    Real t_min;
+    Real t_max;
+};
+
+inline TraversalRay::TraversalRay(const Ray &ray, const Real t_min, const Real t_max)
+    : ray(ray)
+    , origin(ray.origin())
+    , inverse_direction(1.0 / ray.direction())
+    , t_min(t_min)
+    , t_max(t_max)
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        sign[i] = inverse_direction[i] < 0 ? 1 : 0;
+    }
+}
+
+// Branch-free slab test against the box [low, high]. `t_enter` and `t_exit` receive the distances
+// at which the ray enters and leaves the box, it is hit if t_enter <= t_exit. Axes on which the
+// ray origin lies exactly on a slab produce NaN and are ignored.
+template <typename Bounds>
+inline void slab_test(const TraversalRay &ray, const Bounds &low, const Bounds &high, Real &t_enter, Real &t_exit)
+{
+    const Bounds* bounds[2] = {&low, &high};
+    t_enter = -std::numeric_limits<Real>::infinity();
+    t_exit = std::numeric_limits<Real>::infinity();
+    for (int i = 0; i < 3; ++i)
+    {
+        const Real near = ((*bounds[ray.sign[i]])[i] - ray.origin[i]) * ray.inverse_direction[i];
+        const Real far = ((*bounds[1 - ray.sign[i]])[i] - ray.origin[i]) * ray.inverse_direction[i];
+        t_enter = std::max(t_enter, near);
+        t_exit = std::min(t_exit, far);
+    }
+}
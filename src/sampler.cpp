@@ -0,0 +1,250 @@
+#include "sampler.hpp"
+
+#include <algorithm>
+#include <array>
+
+namespace
+{
+    constexpr double ONE_MINUS_EPSILON = 0x1.fffffffffffffp-1;
+
+    uint32_t reverse_bits(uint32_t v)
+    {
+        v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+        v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+        v = ((v >> 4) & 0x0f0f0f0fu) | ((v & 0x0f0f0f0fu) << 4);
+        v = ((v >> 8) & 0x00ff00ffu) | ((v & 0x00ff00ffu) << 8);
+        return (v >> 16) | (v << 16);
+    }
+
+    // Generator matrix of the second Sobol dimension, Pascal's triangle mod 2, applied a byte of the
+    // index at a time: entry [byte][value] is the xor of the columns of the bits set in value, with
+    // its bits reversed. The first dimension's matrix is the identity reversed.
+    using SobolTable = std::array<std::array<uint32_t, 256>, 4>;
+
+    SobolTable sobol_table()
+    {
+        std::array<uint32_t, 32> columns;
+        uint32_t m = 1;
+        for (int k = 0; k < 32; ++k)
+        {
+            columns[k] = m << (31 - k);
+            m ^= m << 1;
+        }
+        SobolTable table;
+        for (int byte = 0; byte < 4; ++byte)
+        {
+            for (uint32_t value = 0; value < 256; ++value)
+            {
+                uint32_t v = 0;
+                for (int bit = 0; bit < 8; ++bit)
+                {
+                    if (value & (1u << bit))
+                    {
+                        v ^= columns[8 * byte + bit];
+                    }
+                }
+                table[byte][value] = reverse_bits(v);
+            }
+        }
+        return table;
+    }
+
+    const SobolTable SOBOL_TABLE = sobol_table();
+
+    // Sobol point `index` of the first two dimensions with its bits reversed, the form Owen scrambling works on
+    uint32_t sobol_reversed(const uint32_t index, const int dimension)
+    {
+        if (dimension == 0)
+        {
+            return index;
+        }
+        return SOBOL_TABLE[0][index & 0xff] ^ SOBOL_TABLE[1][(index >> 8) & 0xff]
+            ^ SOBOL_TABLE[2][(index >> 16) & 0xff] ^ SOBOL_TABLE[3][index >> 24];
+    }
+
+    // Nested uniform scramble of a value given with its bits reversed (Laine and Karras' hash based
+    // Owen scrambling), returns the scrambled value in its normal bit order
+    uint32_t owen_scramble(uint32_t v, const uint32_t seed)
+    {
+        v ^= v * 0x3d20adeau;
+        v += seed;
+        v *= (seed >> 16) | 1;
+        v ^= v * 0x05526c56u;
+        v ^= v * 0x53a22864u;
+        return reverse_bits(v);
+    }
+
+    // Element `i` of a random permutation of [0, 2^k) chosen by `seed`, `mask` is 2^k - 1 (Kensler's hashed permutation)
+    uint32_t permute(uint32_t i, const uint32_t mask, const uint32_t seed)
+    {
+        i ^= seed;
+        i *= 0xe170893du;
+        i ^= seed >> 16;
+        i ^= (i & mask) >> 4;
+        i ^= seed >> 8;
+        i *= 0x0929eb3fu;
+        i ^= seed >> 23;
+        i ^= (i & mask) >> 1;
+        i *= 1 | seed >> 27;
+        i *= 0x6935fa69u;
+        i ^= (i & mask) >> 11;
+        i *= 0x74dcb303u;
+        i ^= (i & mask) >> 2;
+        i *= 0x9e501cc3u;
+        i ^= (i & mask) >> 2;
+        i *= 0xc860a3dfu;
+        i &= mask;
+        i ^= i >> 5;
+        return (i + seed) & mask;
+    }
+
+    // Picks one of `n` from two values that are already well mixed, by the high bits of a short
+    // multiply-xorshift hash of their combination
+    uint32_t pick(const uint32_t a, const uint32_t b, const uint32_t n)
+    {
+        uint32_t x = (a ^ b) * 0x7feb352du;
+        x ^= x >> 15;
+        x *= 0x846ca68bu;
+        return static_cast<uint32_t>((static_cast<uint64_t>(x) * n) >> 32);
+    }
+
+    double to_unit(const uint32_t v)
+    {
+        return std::min(v * 0x1p-32, ONE_MINUS_EPSILON);
+    }
+
+    uint64_t interleave(uint32_t x)
+    {
+        uint64_t v = x;
+        v = (v | (v << 16)) & 0x0000ffff0000ffffULL;
+        v = (v | (v << 8)) & 0x00ff00ff00ff00ffULL;
+        v = (v | (v << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+        v = (v | (v << 2)) & 0x3333333333333333ULL;
+        v = (v | (v << 1)) & 0x5555555555555555ULL;
+        return v;
+    }
+
+    int log2_ceil(const int value)
+    {
+        int log2 = 0;
+        while ((1 << log2) < value)
+        {
+            ++log2;
+        }
+        return log2;
+    }
+
+    // All orders of four base 4 digits
+    constexpr uint8_t PERMUTATIONS[24][4] = {
+        {0, 1, 2, 3}, {0, 1, 3, 2}, {0, 2, 1, 3}, {0, 2, 3, 1}, {0, 3, 2, 1}, {0, 3, 1, 2},
+        {1, 0, 2, 3}, {1, 0, 3, 2}, {1, 2, 0, 3}, {1, 2, 3, 0}, {1, 3, 2, 0}, {1, 3, 0, 2},
+        {2, 1, 0, 3}, {2, 1, 3, 0}, {2, 0, 1, 3}, {2, 0, 3, 1}, {2, 3, 0, 1}, {2, 3, 1, 0},
+        {3, 1, 2, 0}, {3, 1, 0, 2}, {3, 2, 1, 0}, {3, 2, 0, 1}, {3, 0, 2, 1}, {3, 0, 1, 2}
+    };
+}
+
+SamplerSettings::SamplerSettings(const SamplerType type, const uint64_t frame, const int samples, const int width,
+                                 const int height)
+    : type(type)
+    , frame(frame)
+    , log2Samples(log2_ceil(samples))
+    , log2Resolution(log2_ceil(std::max(width, height)))
+{
+}
+
+Sampler::Sampler(const SamplerSettings &settings, const uint32_t pixel, const uint32_t x, const uint32_t y,
+                 const uint32_t sample)
+    : type_(settings.type)
+    , sample_(sample)
+    , log2Samples_(settings.log2Samples)
+    , base4Digits_(std::min(settings.log2Resolution + (settings.log2Samples + 1) / 2, MAX_BASE4_DIGITS))
+{
+    switch (type_)
+    {
+        case SamplerType::INDEPENDENT:
+            rng_ = Rng(settings.frame, pixel, sample);
+            break;
+        case SamplerType::SOBOL:
+            seed_ = mix_bits(mix_bits(settings.frame) ^ pixel);
+            break;
+        case SamplerType::BLUE_NOISE:
+            // Indices only fit 32 bits up to 4096 pixels a side at 256 samples, larger images repeat patterns
+            seed_ = mix_bits(settings.frame);
+            mortonIndex_ = ((interleave(x) | (interleave(y) << 1)) << log2Samples_) | sample;
+            // The digits above each digit pick its permutation together with the dimension. Their
+            // part is hashed here once, so a value only costs a small hash per digit.
+            for (int i = 0; i < base4Digits_; ++i)
+            {
+                const int shift = 2 * i - (log2Samples_ & 1);
+                digitHashes_[i] = static_cast<uint32_t>(mix_bits((mortonIndex_ >> (shift + 2)) ^ seed_));
+            }
+            break;
+    }
+}
+
+double Sampler::get1D()
+{
+    if (type_ == SamplerType::INDEPENDENT)
+    {
+        return rng_.unit();
+    }
+    const uint64_t hash = mix_bits(seed_ ^ dimension_);
+    const uint32_t index = sobolIndex(hash);
+    ++dimension_;
+    return to_unit(owen_scramble(sobol_reversed(index, 0), static_cast<uint32_t>(hash)));
+}
+
+void Sampler::get2D(double &u, double &v)
+{
+    if (type_ == SamplerType::INDEPENDENT)
+    {
+        u = rng_.unit();
+        v = rng_.unit();
+        return;
+    }
+    const uint64_t hash = mix_bits(seed_ ^ dimension_);
+    const uint32_t index = sobolIndex(hash);
+    dimension_ += 2;
+    u = to_unit(owen_scramble(sobol_reversed(index, 0), static_cast<uint32_t>(hash)));
+    v = to_unit(owen_scramble(sobol_reversed(index, 1), static_cast<uint32_t>(hash >> 32)));
+}
+
+void Sampler::beginBounce(const int depth)
+{
+    dimension_ = CAMERA_DIMENSIONS + depth * BOUNCE_DIMENSIONS;
+}
+
+uint32_t Sampler::sobolIndex(const uint64_t hash) const
+{
+    if (type_ == SamplerType::SOBOL)
+    {
+        // Every dimension scrambles the same points, without shuffling their order per dimension
+        // the values of different dimensions would be correlated
+        return permute(sample_, (1u << log2Samples_) - 1, static_cast<uint32_t>(mix_bits(hash)));
+    }
+
+    // Permute the base 4 digits of the Morton index, each by a permutation chosen from the digits
+    // above it. Pixels keep their quadrants at every level but visit them in a random order, which
+    // differs per dimension. An odd power of two of samples leaves a single base 2 digit at the bottom.
+    const auto dimension_hash = static_cast<uint32_t>(hash >> 16);
+    const bool odd = log2Samples_ & 1;
+    uint64_t index = 0;
+    for (int i = base4Digits_ - 1; i >= (odd ? 1 : 0); --i)
+    {
+        const int shift = 2 * i - (odd ? 1 : 0);
+        const uint32_t permutation = pick(digitHashes_[i], dimension_hash, 24);
+        index |= static_cast<uint64_t>(PERMUTATIONS[permutation][(mortonIndex_ >> shift) & 3]) << shift;
+    }
+    if (odd)
+    {
+        index |= (mortonIndex_ & 1) ^ pick(digitHashes_[0], dimension_hash, 2);
+    }
+    return static_cast<uint32_t>(index);
+}
+
+Vec3 sample_unit_ball(Sampler &sampler)
+{
+    double u, v;
+    sampler.get2D(u, v);
+    return unit_ball(u, v, sampler.get1D());
+}
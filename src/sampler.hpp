@@ -0,0 +1,76 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#include "random.hpp"
+#include "vec3.hpp"
+
+enum class SamplerType
+{
+    // Independent uniform numbers from PCG32
+    INDEPENDENT,
+    // Owen scrambled Sobol points. Every dimension is scrambled with its own seed per pixel, so
+    // dimensions are stratified on their own and pairs of them (2D) jointly.
+    SOBOL,
+    // Owen scrambled Sobol points shared by the whole image. Pixels take their indices along a
+    // randomly permuted Morton curve, so neighbouring pixels get complementary samples and what
+    // error remains is distributed as blue noise (Ahmed and Wonka, 2020).
+    BLUE_NOISE
+};
+
+// Fixed for a frame, shared by the samplers of all its pixels
+struct SamplerSettings
+{
+    SamplerSettings(const SamplerType type, const uint64_t frame, const int samples, const int width, const int height);
+
+    SamplerType type;
+    uint64_t frame;
+    // log2 of the samples per pixel and of the larger image side, both rounded up
+    int log2Samples;
+    int log2Resolution;
+};
+
+// Produces the sample values of one camera sample and the path that follows it. Values are
+// addressed by dimension: the camera jitter takes the first ones, then every bounce starts at a
+// fixed dimension of its own, so the values a bounce gets do not depend on how many the bounces
+// before it used.
+class Sampler
+{
+    public:
+        Sampler() = default;
+        Sampler(const SamplerSettings &settings, const uint32_t pixel, const uint32_t x, const uint32_t y,
+                const uint32_t sample);
+
+        // Uniform in [0, 1)
+        double get1D();
+        // Two values of one stratified 2D pattern
+        void get2D(double &u, double &v);
+        // Moves on to the dimensions of bounce `depth`, the camera ray is depth 0
+        void beginBounce(const int depth);
+
+        // Dimensions of the camera jitter and reserved per bounce
+        static constexpr uint32_t CAMERA_DIMENSIONS = 2;
+        static constexpr uint32_t BOUNCE_DIMENSIONS = 64;
+        // Enough for 32 bit Morton indices
+        static constexpr int MAX_BASE4_DIGITS = 16;
+
+    private:
+        // Sobol index of this sample for the current dimension, whose seed is `hash`
+        uint32_t sobolIndex(const uint64_t hash) const;
+
+        SamplerType type_ = SamplerType::INDEPENDENT;
+        Rng rng_;
+        uint64_t seed_ = 0;
+        uint64_t mortonIndex_ = 0;
+        uint32_t sample_ = 0;
+        uint32_t dimension_ = 0;
+        int log2Samples_ = 0;
+        // Digits of the Morton index in base 4, the lowest one is a single bit for odd log2Samples_
+        int base4Digits_ = 0;
+        // Hash of the digits above every digit of the Morton index, the same for all dimensions
+        std::array<uint32_t, MAX_BASE4_DIGITS> digitHashes_;
+};
+
+// Uniform point within the unit ball from a sampler, without rejection
+Vec3 sample_unit_ball(Sampler &sampler);
@@ -0,0 +1,367 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "box.hpp"
+#include "instance.hpp"
+#include "kdtree-scene.hpp"
+#include "material.hpp"
+#include "obj-loader.hpp"
+#include "sphere.hpp"
+#include "transform.hpp"
+#include "triangle-mesh.hpp"
+#include "vec3.hpp"
+
+template<typename T>
+inline T lerp(double f, T a, T b)
+{
+    return (1.0f - f) * a + f * b;
+}
+
+// Camera placement at one point of the animation. `time` runs from 0 at the first frame to 1 at the last.
+struct CameraKey
+{
+    Real time;
+    Vec3 position;
+    Vec3 look_at;
+};
+
+// Everything needed to set up a scene: materials, primitives and the camera animation.
+// It can be read from the text format below or from a compiled scene (compiled-scene.hpp).
+//
+//   # Comments run to the end of the line
+//   frames 250
+//   camera <vertical fov in degrees>
+//   key <time> <position x y z> <look at x y z>
+//   material <name> <diffuse r g b> <reflective r g b> <roughness> [emissive <r g b>]
+//   sphere <material> <center x y z> <radius> [emissive]
+//   box <material> <center x y z> <dimensions x y z> [emissive]
+//   mesh <material> <obj file> [emissive]
+//   object <name> <material> <obj file>
+//   instance <object> <position x y z> <rotation axis x y z> <degrees> <scale> [emissive]
+//
+// Materials are physics materials and must be declared before they are used. Primitives marked
+// emissive are sampled as lights. Mesh paths are relative to the scene file. Objects are meshes
+// that are not placed themselves but share their geometry between any number of instances.
+struct SceneDescription
+{
+    struct SphereRecord
+    {
+        Vec3 center;
+        Real radius;
+        MaterialId material;
+        uint32_t emissive;
+    };
+
+    struct BoxRecord
+    {
+        Vec3 center;
+        Vec3 dimensions;
+        MaterialId material;
+        uint32_t emissive;
+    };
+
+    struct MeshRecord
+    {
+        std::shared_ptr<const MeshData> mesh;
+        MaterialId material;
+        uint32_t emissive;
+        // Objects only appear through instances
+        uint32_t placed;
+    };
+
+    struct InstanceRecord
+    {
+        Transform to_world;
+        // Index into meshes
+        uint32_t mesh;
+        uint32_t emissive;
+    };
+
+    MaterialId addMaterial(const Material &material);
+    void addSphere(const Vec3 &center, const Real radius, const MaterialId material, const bool emissive = false);
+    void addBox(const Vec3 &center, const Vec3 &dimensions, const MaterialId material, const bool emissive = false);
+    void addMesh(std::shared_ptr<const MeshData> mesh, const MaterialId material, const bool emissive = false,
+                 const bool placed = true);
+    void addInstance(const uint32_t mesh, const Transform &to_world, const bool emissive = false);
+
+    // Interpolates the camera keys at `time`
+    CameraKey camera(const Real time) const;
+    // Adds materials and entities to `scene`, spheres first, then boxes, meshes and instances. Does not build the tree.
+    void populate(KDTreeScene &scene) const;
+
+    int frames = 1;
+    Real vertical_fov = 25;
+    std::vector<CameraKey> camera_keys;
+    std::vector<Material> materials;
+    std::vector<SphereRecord> spheres;
+    std::vector<BoxRecord> boxes;
+    std::vector<MeshRecord> meshes;
+    std::vector<InstanceRecord> instances;
+};
+
+MaterialId SceneDescription::addMaterial(const Material &material)
+{
+    materials.push_back(material);
+    return static_cast<MaterialId>(materials.size() - 1);
+}
+
+void SceneDescription::addSphere(const Vec3 &center, const Real radius, const MaterialId material, const bool emissive)
+{
+    spheres.push_back({center, radius, material, emissive});
+}
+
+void SceneDescription::addBox(const Vec3 &center, const Vec3 &dimensions, const MaterialId material, const bool emissive)
+{
+    boxes.push_back({center, dimensions, material, emissive});
+}
+
+void SceneDescription::addMesh(std::shared_ptr<const MeshData> mesh, const MaterialId material, const bool emissive,
+                               const bool placed)
+{
+    meshes.push_back({std::move(mesh), material, emissive, placed});
+}
+
+void SceneDescription::addInstance(const uint32_t mesh, const Transform &to_world, const bool emissive)
+{
+    instances.push_back({to_world, mesh, emissive});
+}
+
+CameraKey SceneDescription::camera(const Real time) const
+{
+    if (camera_keys.empty())
+    {
+        return {time, Vec3(0, 0, 1), Vec3(0)};
+    }
+    const auto next = std::find_if(camera_keys.begin(), camera_keys.end(), [&](const CameraKey &key) {
+        return key.time > time;
+    });
+    if (next == camera_keys.begin())
+    {
+        return camera_keys.front();
+    }
+    if (next == camera_keys.end())
+    {
+        return camera_keys.back();
+    }
+    const CameraKey &previous = *(next - 1);
+    const double f = (time - previous.time) / (next->time - previous.time);
+    return {time, lerp(f, previous.position, next->position), lerp(f, previous.look_at, next->look_at)};
+}
+
+void SceneDescription::populate(KDTreeScene &scene) const
+{
+    for (const auto &material : materials)
+    {
+        scene.addMaterial(material);
+    }
+    for (const auto &sphere : spheres)
+    {
+        scene.entities.emplace_back(std::make_shared<Sphere>(sphere.center, sphere.radius, sphere.material));
+        scene.entities.back()->emissive = sphere.emissive;
+    }
+    for (const auto &box : boxes)
+    {
+        scene.entities.emplace_back(std::make_shared<Box>(box.center, box.dimensions, box.material));
+        scene.entities.back()->emissive = box.emissive;
+    }
+    std::vector<std::shared_ptr<const Entity>> mesh_entities;
+    for (const auto &mesh : meshes)
+    {
+        auto entity = std::make_shared<TriangleMesh>(mesh.mesh, mesh.material);
+        mesh_entities.push_back(entity);
+        if (mesh.placed)
+        {
+            scene.entities.emplace_back(std::move(entity));
+            scene.entities.back()->emissive = mesh.emissive;
+        }
+    }
+    for (const auto &instance : instances)
+    {
+        scene.entities.emplace_back(std::make_shared<Instance>(mesh_entities[instance.mesh], instance.to_world));
+        scene.entities.back()->emissive = instance.emissive;
+    }
+}
+
+// Reads a scene in the text format, reports the first error with its line to std::cerr
+bool parse_scene(const std::string &path, SceneDescription &description)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        std::cerr << "Failed to open " << path << "\n";
+        return false;
+    }
+
+    std::map<std::string, MaterialId> material_ids;
+    std::map<std::string, uint32_t> object_ids;
+    const auto find_material = [&](const std::string &name, MaterialId &id) {
+        const auto it = material_ids.find(name);
+        if (it == material_ids.end())
+        {
+            return false;
+        }
+        id = it->second;
+        return true;
+    };
+
+    std::string line;
+    int line_number = 0;
+    while (std::getline(file, line))
+    {
+        line_number++;
+        line = line.substr(0, line.find('#'));
+        std::istringstream in(line);
+        std::string keyword;
+        if (!(in >> keyword))
+        {
+            continue;
+        }
+
+        bool valid = true;
+        std::string error = "invalid " + keyword;
+        std::string option;
+        if (keyword == "frames")
+        {
+            valid = static_cast<bool>(in >> description.frames) && description.frames > 0;
+        }
+        else if (keyword == "camera")
+        {
+            valid = static_cast<bool>(in >> description.vertical_fov);
+        }
+        else if (keyword == "key")
+        {
+            CameraKey key;
+            valid = static_cast<bool>(in >> key.time >> key.position >> key.look_at);
+            if (valid && !description.camera_keys.empty() && key.time <= description.camera_keys.back().time)
+            {
+                valid = false;
+                error = "camera keys must be in increasing time order";
+            }
+            description.camera_keys.push_back(key);
+        }
+        else if (keyword == "material")
+        {
+            std::string name;
+            Vec3 diffuse, reflective;
+            Real roughness;
+            valid = static_cast<bool>(in >> name >> diffuse >> reflective >> roughness);
+            Material material = Material::physics(diffuse, reflective, roughness);
+            if (valid && in >> option)
+            {
+                valid = option == "emissive" && in >> material.emissive;
+            }
+            material_ids[name] = description.addMaterial(material);
+        }
+        else if (keyword == "sphere" || keyword == "box")
+        {
+            std::string name;
+            MaterialId material = 0;
+            Vec3 center, dimensions;
+            Real radius = 0;
+            valid = static_cast<bool>(in >> name >> center);
+            valid = valid && (keyword == "sphere" ? static_cast<bool>(in >> radius) : static_cast<bool>(in >> dimensions));
+            if (valid && !find_material(name, material))
+            {
+                valid = false;
+                error = "unknown material " + name;
+            }
+            bool emissive = false;
+            if (valid && in >> option)
+            {
+                valid = option == "emissive";
+                emissive = true;
+            }
+            if (keyword == "sphere")
+            {
+                description.addSphere(center, radius, material, emissive);
+            }
+            else
+            {
+                description.addBox(center, dimensions, material, emissive);
+            }
+        }
+        else if (keyword == "mesh" || keyword == "object")
+        {
+            std::string object_name, name, mesh_path;
+            MaterialId material = 0;
+            valid = (keyword == "mesh" || static_cast<bool>(in >> object_name)) && static_cast<bool>(in >> name >> mesh_path);
+            if (valid && !find_material(name, material))
+            {
+                valid = false;
+                error = "unknown material " + name;
+            }
+            bool emissive = false;
+            if (valid && keyword == "mesh" && in >> option)
+            {
+                valid = option == "emissive";
+                emissive = true;
+            }
+            auto mesh = std::make_shared<MeshData>();
+            const std::filesystem::path resolved = std::filesystem::path(path).parent_path() / mesh_path;
+            if (valid && !load_obj(resolved.string(), *mesh))
+            {
+                valid = false;
+                error = "failed to load mesh " + mesh_path;
+            }
+            if (keyword == "object")
+            {
+                object_ids[object_name] = static_cast<uint32_t>(description.meshes.size());
+            }
+            description.addMesh(std::move(mesh), material, emissive, keyword == "mesh");
+        }
+        else if (keyword == "instance")
+        {
+            std::string name;
+            Vec3 position, axis;
+            Real degrees, scale;
+            valid = static_cast<bool>(in >> name >> position >> axis >> degrees >> scale);
+            valid = valid && scale != 0 && axis.length() > 0;
+            const auto object = object_ids.find(name);
+            if (valid && object == object_ids.end())
+            {
+                valid = false;
+                error = "unknown object " + name;
+            }
+            bool emissive = false;
+            if (valid && in >> option)
+            {
+                valid = option == "emissive";
+                emissive = true;
+            }
+            if (valid)
+            {
+                const Transform to_world = Transform::translation(position) * Transform::rotation(axis, degrees)
+                    * Transform::scaling(Vec3(scale));
+                description.addInstance(object->second, to_world, emissive);
+            }
+        }
+        else
+        {
+            valid = false;
+            error = "unknown keyword " + keyword;
+        }
+
+        if (valid && in >> option)
+        {
+            valid = false;
+            error = "unexpected " + option + " after " + keyword;
+        }
+        if (!valid)
+        {
+            std::cerr << path << ":" << line_number << ": " << error << "\n";
+            return false;
+        }
+    }
+    return true;
+}
@@ -3,42 +3,101 @@
 #include <memory>
 #include <vector>
 #include "entity.hpp"
+#include "light-tree.hpp"
+#include "material.hpp"
 
 class Scene: public Entity
 {
     public:
         Scene() {};
-        virtual bool hit(const Ray& r, const double t_min, const double t_max, HitData &data) const;
+        virtual bool intersect(const TraversalRay &ray, HitData &data) const;
+        virtual bool occludes(const TraversalRay &ray) const;
         virtual void update();
+        // Appends to the material table and returns the id entities refer to it by
+        MaterialId addMaterial(const Material &material);
         std::vector<std::shared_ptr<Entity>> entities;
         std::vector<std::shared_ptr<Entity>> emissive_entities;
+        // Picks among emissive_entities, rebuilt by update()
+        LightTree lights;
+        std::vector<Material> materials;
+
+    protected:
+        // Tests the entity that blocked the last occlusion query of this thread in this scene
+        bool occludedByLast(const TraversalRay &ray) const;
+        void rememberOccluder(const size_t entity) const;
+};
+
+// Shadow rays of neighbouring shading points are mostly blocked by the same entity,
+// so every thread remembers the last occluder it found and tests it first.
+struct OccluderCache
+{
+    const Scene *scene = nullptr;
+    size_t entity = 0;
 };
+thread_local OccluderCache last_occluder;
 
-bool Scene::hit(const Ray& r, const double t_min, const double t_max, HitData &data) const
+bool Scene::intersect(const TraversalRay &ray, HitData &data) const
 {
-    data.t = t_max;
-    HitData temp_data;
-    double closest_hit = t_max + 1;
+    TraversalRay closest = ray;
+    bool found = false;
     for (const auto &e : entities)
     {
-        if (e->hit(r, t_min, closest_hit, temp_data))
+        if (e->intersect(closest, data))
+        {
+            closest.t_max = data.t;
+            found = true;
+        }
+    }
+    return found;
+}
+
+bool Scene::occludes(const TraversalRay &ray) const
+{
+    if (occludedByLast(ray))
+    {
+        return true;
+    }
+    for (size_t i = 0; i < entities.size(); ++i)
+    {
+        if (entities[i]->occludes(ray))
         {
-            closest_hit = temp_data.t;
-            data = temp_data;
+            rememberOccluder(i);
+            return true;
         }
     }
-    return closest_hit < t_max;
+    return false;
+}
+
+bool Scene::occludedByLast(const TraversalRay &ray) const
+{
+    return last_occluder.scene == this && last_occluder.entity < entities.size()
+        && entities[last_occluder.entity]->occludes(ray);
+}
+
+void Scene::rememberOccluder(const size_t entity) const
+{
+    last_occluder = {this, entity};
+}
+
+MaterialId Scene::addMaterial(const Material &material)
+{
+    materials.push_back(material);
+    return static_cast<MaterialId>(materials.size() - 1);
 }
 
 void Scene::update()
 {
     emissive_entities.clear();
+    boundingBox = AABB::empty();
     for (auto &e : entities)
     {
         e->update();
+        boundingBox.expand(e->boundingBox);
         if (e->emissive)
         {
             emissive_entities.emplace_back(e);
         }
     }
+    transform = (boundingBox.low + boundingBox.high) / 2.0;
+    lights.build(emissive_entities, materials);
 }
\ No newline at end of file
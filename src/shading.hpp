@@ -0,0 +1,136 @@
+#pragma once
+
+#include <algorithm>
+
+#include "entity.hpp"
+#include "material.hpp"
+#include "ray.hpp"
+#include "sampler.hpp"
+#include "scene.hpp"
+#include "vec3.hpp"
+
+// Pieces of the shading model shared by the recursive and the wavefront integrator, so both
+// trace the same rays and draw the same sample values in the same order.
+
+// Interval searched along every ray
+constexpr Real RAY_T_MIN = 0.001f;
+constexpr Real RAY_T_MAX = 1000.0f;
+// Light samples per hit, the scene's light tree spreads them over the emissive entities
+constexpr int LIGHT_SAMPLES = 10;
+// Paths with a throughput above this always survive the Russian roulette, dimmer ones in proportion
+// to it. Ending bright paths would add more noise than the rays saved are worth.
+constexpr double ROULETTE_THRESHOLD = 0.25;
+// Direct light of a hit in the sun's shadow is scaled by this
+constexpr double SUN_SHADOW = 0.2f;
+
+// Length of the traced paths, the camera ray has depth 0. Scattered rays are always followed up to
+// minDepth. Beyond it Russian roulette ends paths whose throughput dropped below
+// ROULETTE_THRESHOLD, and no ray is followed past maxDepth.
+struct PathSettings
+{
+    int minDepth;
+    int maxDepth;
+};
+
+// Scattering is skipped altogether at maxDepth and for materials that reflect nothing
+inline bool can_scatter(const PathSettings &settings, const int depth, const Material &material)
+{
+    return depth < settings.maxDepth && material.scatters();
+}
+
+// Russian roulette for the ray scattered at `depth`, true if it is followed. `throughput` is the
+// attenuation the path has collected before this hit. Survivors have `attenuation` divided by
+// their survival probability, so ending the others early keeps the estimate unbiased.
+inline bool continue_path(const PathSettings &settings, const int depth, const Vec3 &throughput, Vec3 &attenuation,
+                          Sampler &sampler)
+{
+    const Vec3 next = throughput * attenuation;
+    const double survival = std::min(1.0, std::max({next[0], next[1], next[2]}) / ROULETTE_THRESHOLD);
+    if (survival <= 0.0)
+    {
+        return false;
+    }
+    if (depth >= settings.minDepth)
+    {
+        if (sampler.get1D() >= survival)
+        {
+            return false;
+        }
+        attenuation /= static_cast<Real>(survival);
+    }
+    return true;
+}
+
+// Color of rays that leave the scene
+inline Vec3 sky(const Ray &r)
+{
+    Vec3 color(0.0f);
+    Vec3 unit_direction = r.direction().normalized();
+    Real t = 0.5 * (unit_direction.y() + 1.0f);
+    color += (1.0f - t) * Vec3(1.0, 1.0, 1.0) + t * Vec3(0.5, 0.7, 1.0);
+    color *= 0.1;
+    return color;
+}
+
+inline Ray sun_ray(const HitData &data)
+{
+    return Ray(data.hit_point + data.normal * 0.001f, Vec3(1, 1 ,-1).normalized());
+}
+
+// Color of a surface as the denoiser sees it, reflecting direct light and scattered rays
+inline Vec3 surface_albedo(const Material &material)
+{
+    return material.diffuse + material.reflective;
+}
+
+// Light samples aim at random points within this distance of an emissive entity's center
+inline double light_radius(const Entity &light)
+{
+    const Vec3 half_dimensions = (light.boundingBox.high - light.boundingBox.low) / 2.0f;
+    return half_dimensions.length();
+}
+
+// Beyond this distance a light sample cannot hit `light` anymore
+inline double light_distance(const HitData &data, const Entity &light, const double radius)
+{
+    return (light.transform - data.hit_point).length() + radius;
+}
+
+inline Ray light_ray(const HitData &data, const Entity &light, const double radius, Sampler &sampler)
+{
+    const Vec3 target = light.transform + sample_unit_ball(sampler) * radius;
+    return Ray(data.hit_point + data.normal * 0.001f, (target - data.hit_point).normalized());
+}
+
+// Light a sample adds when it reaches an emitter at distance `t` unobstructed, `pdf` is the
+// probability the emitter was picked with
+inline Vec3 light_contribution(const Material &material, const Material &emitter, const Real t, const double pdf)
+{
+    return material.diffuse * (emitter.emissive / (t * t)) / (LIGHT_SAMPLES * pdf);
+}
+
+// Casts one light sample at a light picked by the scene's light tree. Returns false if it misses
+// the light, otherwise the ray, the distance up to which it must be unoccluded and the light it adds then.
+inline bool sample_light(const Scene &scene, const HitData &data, const Material &material, Sampler &sampler,
+                         Ray &lightray, Real &t_max, Vec3 &contribution)
+{
+    uint32_t light;
+    double pdf;
+    if (!scene.lights.sample(data, sampler, light, pdf))
+    {
+        return false;
+    }
+    const Entity &e = *scene.emissive_entities[light];
+    const double radius = light_radius(e);
+    const double max_dist = light_distance(data, e, radius);
+    lightray = light_ray(data, e, radius, sampler);
+    // Find the light itself first, the caller then only asks whether anything is in between
+    HitData lightData;
+    if (!e.hit(lightray, RAY_T_MIN, max_dist, lightData))
+    {
+        return false;
+    }
+    t_max = lightData.t - 0.001f;
+    contribution = light_contribution(material, scene.materials[lightData.material], lightData.t, pdf);
+    return true;
+}
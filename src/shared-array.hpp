@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+// Contiguous array over storage it shares ownership of: either a vector it took over or memory
+// owned by another object, such as a mapped compiled scene, which stays alive as long as an array
+// points into it. Copies and slices share the values instead of copying them.
+template <typename T>
+class SharedArray
+{
+    public:
+        SharedArray() = default;
+        SharedArray(std::vector<T> values)
+        {
+            auto storage = std::make_shared<std::vector<T>>(std::move(values));
+            data_ = storage->data();
+            size_ = storage->size();
+            owner_ = std::move(storage);
+        }
+        SharedArray(std::shared_ptr<const void> owner, T *data, const size_t size)
+            : owner_(std::move(owner))
+            , data_(data)
+            , size_(size)
+        {
+        }
+
+        // `count` values starting at `offset`, sharing this array's storage
+        SharedArray slice(const size_t offset, const size_t count) const
+        {
+            return SharedArray(owner_, data_ + offset, count);
+        }
+
+        T* data() const { return data_; }
+        size_t size() const { return size_; }
+        bool empty() const { return size_ == 0; }
+        T& operator[](const size_t i) const { return data_[i]; }
+        T& front() const { return data_[0]; }
+        T* begin() const { return data_; }
+        T* end() const { return data_ + size_; }
+
+    private:
+        std::shared_ptr<const void> owner_;
+        T *data_ = nullptr;
+        size_t size_ = 0;
+};
@@ -0,0 +1,110 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "vec3.hpp"
+
+// Number of rays traced together in a packet, set through RAYTRACER_PACKET_SIZE
+#ifndef RAYTRACER_PACKET_SIZE
+#define RAYTRACER_PACKET_SIZE 8
+#endif
+
+constexpr int PACKET_SIZE = RAYTRACER_PACKET_SIZE;
+static_assert(PACKET_SIZE == 4 || PACKET_SIZE == 8 || PACKET_SIZE == 16, "Packets hold 4, 8 or 16 rays");
+
+// GCC/Clang vector extensions: these lower to SSE, AVX2 or AVX-512 depending on the target
+// flags and fall back to scalar code on targets without vector units.
+typedef Real PacketReal __attribute__((vector_size(PACKET_SIZE * sizeof(Real))));
+using PacketLane = std::conditional_t<sizeof(Real) == sizeof(float), int32_t, int64_t>;
+typedef PacketLane PacketMask __attribute__((vector_size(PACKET_SIZE * sizeof(PacketLane))));
+
+namespace Simd
+{
+    inline PacketReal broadcast(const Real value)
+    {
+        PacketReal v = {};
+        return v + value;
+    }
+
+    // Unaligned load of PACKET_SIZE consecutive values
+    inline PacketReal load(const Real *values)
+    {
+        PacketReal v = {};
+        std::memcpy(&v, values, sizeof(v));
+        return v;
+    }
+
+    // Mask of the first `n` lanes
+    inline PacketMask first_lanes(const int n)
+    {
+        PacketMask mask;
+        for (int i = 0; i < PACKET_SIZE; ++i)
+        {
+            mask[i] = i < n ? -1 : 0;
+        }
+        return mask;
+    }
+
+    inline PacketReal select(const PacketMask &mask, const PacketReal &a, const PacketReal &b)
+    {
+        return mask ? a : b;
+    }
+
+    inline PacketReal min(const PacketReal &a, const PacketReal &b)
+    {
+        return a < b ? a : b;
+    }
+
+    inline PacketReal max(const PacketReal &a, const PacketReal &b)
+    {
+        return a > b ? a : b;
+    }
+
+    inline PacketReal sqrt(const PacketReal &a)
+    {
+        PacketReal result = {};
+        for (int i = 0; i < PACKET_SIZE; ++i)
+        {
+            result[i] = std::sqrt(a[i]);
+        }
+        return result;
+    }
+
+    inline bool any(const PacketMask &mask)
+    {
+        for (int i = 0; i < PACKET_SIZE; ++i)
+        {
+            if (mask[i])
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Index of the first set lane, -1 if there is none
+    inline int first_set(const PacketMask &mask)
+    {
+        for (int i = 0; i < PACKET_SIZE; ++i)
+        {
+            if (mask[i])
+            {
+                return i;
+            }
+        }
+        return -1;
+    }
+
+    inline int count(const PacketMask &mask)
+    {
+        int n = 0;
+        for (int i = 0; i < PACKET_SIZE; ++i)
+        {
+            n += mask[i] ? 1 : 0;
+        }
+        return n;
+    }
+}
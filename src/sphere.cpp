@@ -7,32 +7,85 @@ void Sphere::update()
     transform = center;
 }
 
-bool Sphere::hit(const Ray& r, const double t_min, const double t_max, HitData& data) const
+bool Sphere::intersect(const TraversalRay& ray, HitData& data) const
 {
-    const Vec3 oc = r.origin() - center;
-    const double a = r.direction().dot(r.direction());
-    const double b = oc.dot(r.direction());
-    const double c = oc.dot(oc) - radius * radius;
-    const double discriminator = b * b - a * c;
+    const Vec3 direction = ray.ray.direction();
+    const Vec3 oc = ray.origin - center;
+    const Real a = direction.dot(direction);
+    const Real b = oc.dot(direction);
+    const Real c = oc.dot(oc) - radius * radius;
+    const Real discriminator = b * b - a * c;
     if (discriminator <= 0.0f)
     {
         return false;
     }
-    const double intersectionLength = sqrt(discriminator) / a;
-    const double bdiva = b / a;
-    double t = (-bdiva - intersectionLength);
-    if (t >= t_max || t <= t_min)
+    const Real intersectionLength = std::sqrt(discriminator) / a;
+    const Real bdiva = b / a;
+    Real t = (-bdiva - intersectionLength);
+    if (t >= ray.t_max || t <= ray.t_min)
     {
         t = (-bdiva + intersectionLength);
-        if (t >= t_max || t <= t_min)
+        if (t >= ray.t_max || t <= ray.t_min)
         {
             return false;
         }
     }
     data.t = t;
-    data.hit_point = r.pointAt(t);
+    data.entity = this;
+    return true;
+}
+
+bool Sphere::occludes(const TraversalRay& ray) const
+{
+    const Vec3 direction = ray.ray.direction();
+    const Vec3 oc = ray.origin - center;
+    const Real a = direction.dot(direction);
+    const Real b = oc.dot(direction);
+    const Real c = oc.dot(oc) - radius * radius;
+    const Real discriminator = b * b - a * c;
+    if (discriminator <= 0.0f)
+    {
+        return false;
+    }
+    const Real intersectionLength = std::sqrt(discriminator) / a;
+    const Real bdiva = b / a;
+    const Real near = -bdiva - intersectionLength;
+    const Real far = -bdiva + intersectionLength;
+    return (near < ray.t_max && near > ray.t_min) || (far < ray.t_max && far > ray.t_min);
+}
+
+PacketMask Sphere::hitPacket(const RayPacket& packet, const PacketMask& active, const Real t_min,
+                             PacketReal& closest, HitPacket& data) const
+{
+    PacketReal t;
+    const PacketMask hits = sphere_packet_test(packet, active, t_min, closest, center, radius, t);
+    if (!Simd::any(hits))
+    {
+        return hits;
+    }
+
+    closest = Simd::select(hits, t, closest);
+    for (int lane = 0; lane < PACKET_SIZE; ++lane)
+    {
+        if (hits[lane])
+        {
+            data[lane].t = t[lane];
+            data[lane].entity = this;
+        }
+    }
+    return hits;
+}
+
+void Sphere::interact(const Ray& r, HitData& data) const
+{
+    data.hit_point = r.pointAt(data.t);
     data.normal = (data.hit_point - center) / radius;
     data.material = material;
-    data.entity = shared_from_this();
+    data.entity = this;
+}
+
+bool Sphere::surfaceMaterial(MaterialId& material) const
+{
+    material = this->material;
     return true;
 }
@@ -1,23 +1,55 @@
 #pragma once
 
-#include <memory>
-#include <utility>
-
 #include "entity.hpp"
 
 class Sphere : public Entity
 {
   public:
-    Sphere(Vec3 center, double radius, std::shared_ptr<Material> material)
+    Sphere(Vec3 center, Real radius, MaterialId material)
         : center(center)
         , radius(radius)
-        , material(std::move(material))
+        , material(material)
     {
         Sphere::update();
     }
     void update() override;
-    bool hit(const Ray& r, const double t_min, const double t_max, HitData& data) const override;
+    bool intersect(const TraversalRay& ray, HitData& data) const override;
+    bool occludes(const TraversalRay& ray) const override;
+    void interact(const Ray& r, HitData& data) const override;
+    bool surfaceMaterial(MaterialId& material) const override;
+    PacketMask hitPacket(const RayPacket& packet, const PacketMask& active, const Real t_min,
+                         PacketReal& closest, HitPacket& data) const override;
     Vec3 center;
-    double radius;
-    std::shared_ptr<Material> material;
+    Real radius;
+    MaterialId material;
 };
+
+// Intersects the active lanes of a packet with a sphere. Returns the lanes that hit within
+// (t_min, closest) and their distance in `t`.
+inline PacketMask sphere_packet_test(const RayPacket& packet, const PacketMask& active, const Real t_min,
+                                     const PacketReal& closest, const Vec3& center, const Real radius, PacketReal& t)
+{
+    const PacketReal ocx = packet.origin[0] - center[0];
+    const PacketReal ocy = packet.origin[1] - center[1];
+    const PacketReal ocz = packet.origin[2] - center[2];
+    const PacketReal* d = packet.direction;
+    const PacketReal a = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
+    const PacketReal b = ocx * d[0] + ocy * d[1] + ocz * d[2];
+    const PacketReal c = ocx * ocx + ocy * ocy + ocz * ocz - radius * radius;
+    const PacketReal discriminator = b * b - a * c;
+    const PacketMask valid = active & (discriminator > 0.0);
+    if (!Simd::any(valid))
+    {
+        return valid;
+    }
+
+    const PacketReal intersectionLength = Simd::sqrt(Simd::max(discriminator, Simd::broadcast(0.0))) / a;
+    const PacketReal bdiva = b / a;
+    const PacketReal near = -bdiva - intersectionLength;
+    const PacketReal far = -bdiva + intersectionLength;
+    const PacketReal lower = Simd::broadcast(t_min);
+    const PacketMask nearInside = (near < closest) & (near > lower);
+    const PacketMask farInside = (far < closest) & (far > lower);
+    t = Simd::select(nearInside, near, far);
+    return valid & (nearInside | farInside);
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <cmath>
+#include <utility>
+#include <vector>
+
+#include "camera.hpp"
+#include "pixel-estimate.hpp"
+#include "vec3.hpp"
+
+// Carries pixel estimates from one animation frame to the next. Every pixel records the surface
+// seen through its center. In the next frame a pixel projects its own surface point into the
+// previous camera and continues the estimate of the pixel it lands on, unless depth or normal
+// disagree there because the surface was hidden or is a different one (a disocclusion).
+class TemporalCache
+{
+    public:
+        TemporalCache(const int width, const int height);
+
+        // Makes the frame recorded so far the history for the frame seen from `camera`
+        void beginFrame(const Camera &camera);
+        // Estimate of the previous frame for the surface at `point`, empty if there is no valid history.
+        // Misses reproject their direction and only match earlier misses.
+        PixelEstimate reproject(const Vec3 &point, const Vec3 &normal, const bool hit) const;
+        // Records the estimate of pixel `index` and the surface seen through its center
+        void store(const int index, const PixelEstimate &estimate, const Real depth, const Vec3 &normal, const bool hit);
+
+        // Relative depth difference and normal agreement (cosine) for history to be reused
+        static constexpr Real DEPTH_TOLERANCE = 0.05;
+        static constexpr Real NORMAL_TOLERANCE = 0.9;
+
+    private:
+        struct Entry
+        {
+            PixelEstimate estimate;
+            Real depth = 0;
+            Vec3 normal;
+            bool hit = false;
+            bool valid = false;
+        };
+
+        int width_;
+        int height_;
+        std::vector<Entry> history_;
+        std::vector<Entry> current_;
+        Camera previous_;
+        Camera camera_;
+        bool hasHistory_ = false;
+        bool started_ = false;
+};
+
+TemporalCache::TemporalCache(const int width, const int height)
+    : width_(width)
+    , height_(height)
+    , history_(width * height)
+    , current_(width * height)
+    , previous_(Vec3(0, 0, 1), Vec3(0), 1, 1)
+    , camera_(previous_)
+{
+}
+
+void TemporalCache::beginFrame(const Camera &camera)
+{
+    if (started_)
+    {
+        std::swap(history_, current_);
+        previous_ = camera_;
+        hasHistory_ = true;
+    }
+    for (Entry &entry : current_)
+    {
+        entry.valid = false;
+    }
+    camera_ = camera;
+    started_ = true;
+}
+
+PixelEstimate TemporalCache::reproject(const Vec3 &point, const Vec3 &normal, const bool hit) const
+{
+    Real u, v;
+    if (!hasHistory_ || !previous_.project(hit ? point : previous_.transform + (point - camera_.transform), u, v))
+    {
+        return PixelEstimate();
+    }
+    // Same pixel layout as the renderer: rows run top down while v runs bottom up
+    const int i = static_cast<int>(std::floor(u * width_));
+    const int row = height_ - static_cast<int>(std::floor(v * height_));
+    if (i < 0 || i >= width_ || row < 0 || row >= height_)
+    {
+        return PixelEstimate();
+    }
+
+    const Entry &entry = history_[row * width_ + i];
+    if (!entry.valid || entry.hit != hit)
+    {
+        return PixelEstimate();
+    }
+    if (hit)
+    {
+        // Stored normals are unit length or zero, a zero normal on either side never matches
+        const Real depth = (point - previous_.transform).length();
+        const Real normal_length = normal.length();
+        if (std::abs(depth - entry.depth) > DEPTH_TOLERANCE * entry.depth || normal_length == 0
+            || normal.dot(entry.normal) < NORMAL_TOLERANCE * normal_length)
+        {
+            return PixelEstimate();
+        }
+    }
+    return entry.estimate;
+}
+
+void TemporalCache::store(const int index, const PixelEstimate &estimate, const Real depth, const Vec3 &normal,
+                          const bool hit)
+{
+    // Entities do not all return unit normals, boxes scale theirs by their dimensions
+    const Real normal_length = normal.length();
+    current_[index] = {estimate, depth, normal_length > 0 ? normal / normal_length : Vec3(0), hit, true};
+}
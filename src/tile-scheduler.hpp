@@ -0,0 +1,116 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <tbb/blocked_range.h>
+#include <tbb/parallel_for.h>
+#include <tbb/partitioner.h>
+
+enum class TileOrder
+{
+    SCANLINE,
+    // Z-order curve, keeps consecutive tiles close together
+    MORTON,
+    // Rings around the image center, so the center converges first
+    SPIRAL
+};
+
+// Pixel rectangle [x0, x1) x [y0, y1)
+struct Tile
+{
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+
+    int pixelCount() const { return (x1 - x0) * (y1 - y0); }
+};
+
+class TileScheduler
+{
+    public:
+        TileScheduler(const int width, const int height, const int tile_size, const TileOrder order);
+
+        // Calls render(tile) for every tile. Tiles are started in scheduling order while TBB
+        // balances the work between threads by work stealing.
+        template <typename F>
+        void run(F &&render) const;
+
+        const std::vector<Tile>& tiles() const { return tiles_; }
+
+    private:
+        std::vector<Tile> tiles_;
+};
+
+inline uint32_t morton_code(const uint32_t x, const uint32_t y)
+{
+    uint32_t code = 0;
+    for (int bit = 0; bit < 16; ++bit)
+    {
+        code |= ((x >> bit) & 1) << (2 * bit);
+        code |= ((y >> bit) & 1) << (2 * bit + 1);
+    }
+    return code;
+}
+
+TileScheduler::TileScheduler(const int width, const int height, const int tile_size, const TileOrder order)
+{
+    const int columns = (width + tile_size - 1) / tile_size;
+    const int rows = (height + tile_size - 1) / tile_size;
+    struct Entry
+    {
+        double key;
+        double angle;
+        Tile tile;
+    };
+    std::vector<Entry> entries;
+    entries.reserve(columns * rows);
+    for (int row = 0; row < rows; ++row)
+    {
+        for (int column = 0; column < columns; ++column)
+        {
+            const Tile tile = {column * tile_size, row * tile_size,
+                               std::min(width, (column + 1) * tile_size), std::min(height, (row + 1) * tile_size)};
+            const double dx = column + 0.5 - columns / 2.0;
+            const double dy = row + 0.5 - rows / 2.0;
+            double key = row * columns + column;
+            double angle = 0.0;
+            if (order == TileOrder::MORTON)
+            {
+                key = morton_code(column, row);
+            }
+            else if (order == TileOrder::SPIRAL)
+            {
+                key = std::floor(std::max(std::abs(dx), std::abs(dy)));
+                angle = std::atan2(dy, dx);
+            }
+            entries.push_back({key, angle, tile});
+        }
+    }
+    std::stable_sort(entries.begin(), entries.end(), [](const Entry &a, const Entry &b) {
+        return a.key < b.key || (a.key == b.key && a.angle < b.angle);
+    });
+
+    tiles_.reserve(entries.size());
+    for (const auto &entry : entries)
+    {
+        tiles_.push_back(entry.tile);
+    }
+}
+
+template <typename F>
+void TileScheduler::run(F &&render) const
+{
+    // Every iteration claims the next tile in order, whichever worker ends up executing it
+    std::atomic<size_t> next(0);
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, tiles_.size(), 1), [&](const tbb::blocked_range<size_t> &range) {
+        for (size_t i = range.begin(); i != range.end(); ++i)
+        {
+            render(tiles_[next.fetch_add(1, std::memory_order_relaxed)]);
+        }
+    }, tbb::simple_partitioner());
+}
@@ -0,0 +1,141 @@
+#pragma once
+
+#include <cmath>
+
+#include "entity.hpp"
+#include "ray.hpp"
+#include "vec3.hpp"
+
+// Affine transform stored as the upper 3x4 part of a 4x4 matrix: a linear map in the first three
+// columns followed by the translation. Points are transformed with the translation, directions without.
+struct Transform
+{
+    static Transform identity();
+    static Transform translation(const Vec3 &offset);
+    static Transform scaling(const Vec3 &factors);
+    // Rotation by `degrees` counterclockwise around `axis`
+    static Transform rotation(const Vec3 &axis, const Real degrees);
+
+    // Applies `other` first and then this transform
+    Transform operator*(const Transform &other) const;
+    Transform inverse() const;
+
+    Vec3 point(const Vec3 &p) const;
+    Vec3 vector(const Vec3 &v) const;
+    // Transforms the direction not normalized, so hit distances along the ray stay the same
+    Ray ray(const Ray &r) const;
+    // Box around the transformed corners of `box`
+    AABB bounds(const AABB &box) const;
+
+    Real m[3][4];
+};
+
+inline Transform Transform::identity()
+{
+    return {{{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}}};
+}
+
+inline Transform Transform::translation(const Vec3 &offset)
+{
+    Transform t = identity();
+    for (int i = 0; i < 3; ++i)
+    {
+        t.m[i][3] = offset[i];
+    }
+    return t;
+}
+
+inline Transform Transform::scaling(const Vec3 &factors)
+{
+    Transform t = identity();
+    for (int i = 0; i < 3; ++i)
+    {
+        t.m[i][i] = factors[i];
+    }
+    return t;
+}
+
+inline Transform Transform::rotation(const Vec3 &axis, const Real degrees)
+{
+    const Vec3 a = axis.normalized();
+    const Real angle = degrees * M_PI / 180.0;
+    const Real c = std::cos(angle);
+    const Real s = std::sin(angle);
+    const Real k = 1 - c;
+    return {{{a[0] * a[0] * k + c, a[0] * a[1] * k - a[2] * s, a[0] * a[2] * k + a[1] * s, 0},
+             {a[1] * a[0] * k + a[2] * s, a[1] * a[1] * k + c, a[1] * a[2] * k - a[0] * s, 0},
+             {a[2] * a[0] * k - a[1] * s, a[2] * a[1] * k + a[0] * s, a[2] * a[2] * k + c, 0}}};
+}
+
+inline Transform Transform::operator*(const Transform &other) const
+{
+    Transform t;
+    for (int i = 0; i < 3; ++i)
+    {
+        for (int j = 0; j < 4; ++j)
+        {
+            t.m[i][j] = m[i][0] * other.m[0][j] + m[i][1] * other.m[1][j] + m[i][2] * other.m[2][j];
+        }
+        t.m[i][3] += m[i][3];
+    }
+    return t;
+}
+
+inline Transform Transform::inverse() const
+{
+    // Inverse of the linear part from its cofactors, the translation is undone afterwards
+    Transform t;
+    for (int i = 0; i < 3; ++i)
+    {
+        const int i1 = (i + 1) % 3;
+        const int i2 = (i + 2) % 3;
+        for (int j = 0; j < 3; ++j)
+        {
+            const int j1 = (j + 1) % 3;
+            const int j2 = (j + 2) % 3;
+            t.m[j][i] = m[i1][j1] * m[i2][j2] - m[i1][j2] * m[i2][j1];
+        }
+    }
+    const Real determinant = m[0][0] * t.m[0][0] + m[0][1] * t.m[1][0] + m[0][2] * t.m[2][0];
+    for (int i = 0; i < 3; ++i)
+    {
+        for (int j = 0; j < 3; ++j)
+        {
+            t.m[i][j] /= determinant;
+        }
+    }
+    for (int i = 0; i < 3; ++i)
+    {
+        t.m[i][3] = -(t.m[i][0] * m[0][3] + t.m[i][1] * m[1][3] + t.m[i][2] * m[2][3]);
+    }
+    return t;
+}
+
+inline Vec3 Transform::point(const Vec3 &p) const
+{
+    return vector(p) + Vec3(m[0][3], m[1][3], m[2][3]);
+}
+
+inline Vec3 Transform::vector(const Vec3 &v) const
+{
+    return Vec3(m[0][0] * v[0] + m[0][1] * v[1] + m[0][2] * v[2],
+                m[1][0] * v[0] + m[1][1] * v[1] + m[1][2] * v[2],
+                m[2][0] * v[0] + m[2][1] * v[1] + m[2][2] * v[2]);
+}
+
+inline Ray Transform::ray(const Ray &r) const
+{
+    return Ray(point(r.origin()), vector(r.direction()));
+}
+
+inline AABB Transform::bounds(const AABB &box) const
+{
+    AABB result = AABB::empty();
+    for (int corner = 0; corner < 8; ++corner)
+    {
+        result.expand(point(Vec3(corner & 1 ? box.high[0] : box.low[0],
+                                 corner & 2 ? box.high[1] : box.low[1],
+                                 corner & 4 ? box.high[2] : box.low[2])));
+    }
+    return result;
+}
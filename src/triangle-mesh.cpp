@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+#include "kdtree-builder.hpp"
+#include "triangle-mesh.hpp"
+
+namespace
+{
+    // Ray transformed for the watertight test of Woop, Benthin and Wald (JCGT 2013): the axis with
+    // the largest direction component becomes z and the ray is sheared onto the z axis, so shared
+    // edges are evaluated identically from both triangles and rays cannot slip through them.
+    struct ShearedRay
+    {
+        explicit ShearedRay(const Ray &ray);
+
+        Vec3 origin;
+        int kx, ky, kz;
+        Real sx, sy, sz;
+    };
+
+    ShearedRay::ShearedRay(const Ray &ray)
+        : origin(ray.origin())
+    {
+        const Vec3 direction = ray.direction();
+        kz = 0;
+        for (int i = 1; i < 3; ++i)
+        {
+            if (std::abs(direction[i]) > std::abs(direction[kz]))
+            {
+                kz = i;
+            }
+        }
+        kx = (kz + 1) % 3;
+        ky = (kx + 1) % 3;
+        // Keep the winding of the triangles
+        if (direction[kz] < 0)
+        {
+            std::swap(kx, ky);
+        }
+        sx = direction[kx] / direction[kz];
+        sy = direction[ky] / direction[kz];
+        sz = 1.0 / direction[kz];
+    }
+
+    // Edge function of the sheared vertices a and b, in double if Real cannot resolve it
+    inline Real edge(const Real ax, const Real ay, const Real bx, const Real by)
+    {
+        const Real e = bx * ay - by * ax;
+        if constexpr (sizeof(Real) < sizeof(double))
+        {
+            if (e == 0)
+            {
+                return static_cast<Real>(static_cast<double>(bx) * ay - static_cast<double>(by) * ax);
+            }
+        }
+        return e;
+    }
+
+    // Returns true on a hit within (t_min, t_max), with the distance and the weights of vertices 1 and 2
+    inline bool intersect_triangle(const ShearedRay &ray, const Vec3f &p0, const Vec3f &p1, const Vec3f &p2,
+                                   const Real t_min, const Real t_max, Real &t, Real &u, Real &v)
+    {
+        const Vec3 a = Vec3(p0) - ray.origin;
+        const Vec3 b = Vec3(p1) - ray.origin;
+        const Vec3 c = Vec3(p2) - ray.origin;
+        const Real ax = a[ray.kx] - ray.sx * a[ray.kz];
+        const Real ay = a[ray.ky] - ray.sy * a[ray.kz];
+        const Real bx = b[ray.kx] - ray.sx * b[ray.kz];
+        const Real by = b[ray.ky] - ray.sy * b[ray.kz];
+        const Real cx = c[ray.kx] - ray.sx * c[ray.kz];
+        const Real cy = c[ray.ky] - ray.sy * c[ray.kz];
+
+        const Real e0 = edge(bx, by, cx, cy);
+        const Real e1 = edge(cx, cy, ax, ay);
+        const Real e2 = edge(ax, ay, bx, by);
+        if ((e0 < 0 || e1 < 0 || e2 < 0) && (e0 > 0 || e1 > 0 || e2 > 0))
+        {
+            return false;
+        }
+        const Real determinant = e0 + e1 + e2;
+        if (determinant == 0)
+        {
+            return false;
+        }
+
+        const Real scaled_t = e0 * ray.sz * a[ray.kz] + e1 * ray.sz * b[ray.kz] + e2 * ray.sz * c[ray.kz];
+        t = scaled_t / determinant;
+        if (!(t > t_min && t < t_max))
+        {
+            return false;
+        }
+        u = e1 / determinant;
+        v = e2 / determinant;
+        return true;
+    }
+}
+
+size_t MeshData::memoryUsage() const
+{
+    return positions.size() * sizeof(positions[0]) + indices.size() * sizeof(indices[0])
+        + nodes.size() * sizeof(nodes[0]);
+}
+
+void MeshData::build()
+{
+    const size_t count = triangleCount();
+    std::vector<AABB> triangle_bounds(count, AABB::empty());
+    bounds = AABB::empty();
+    for (size_t i = 0; i < count; ++i)
+    {
+        for (int corner = 0; corner < 3; ++corner)
+        {
+            triangle_bounds[i].expand(Vec3(positions[indices[3 * i + corner]]));
+        }
+        bounds.expand(triangle_bounds[i]);
+    }
+
+    std::vector<KDN> tree;
+    std::vector<uint32_t> order;
+    KDTreeBuilder builder(triangle_bounds, tree, order, 1, TRIANGLE_INTERSECTION_COST);
+    builder.build(TreeBuilder::SAH);
+    nodes = std::move(tree);
+
+    std::vector<uint32_t> sorted(indices.size());
+    for (size_t i = 0; i < count; ++i)
+    {
+        std::copy_n(indices.begin() + 3 * order[i], 3, sorted.begin() + 3 * i);
+    }
+    indices = std::move(sorted);
+}
+
+bool MeshData::valid() const
+{
+    if (nodes.empty() || indices.size() % 3 != 0)
+    {
+        return false;
+    }
+    for (const uint32_t index : indices)
+    {
+        if (index >= positions.size())
+        {
+            return false;
+        }
+    }
+    return valid_tree(nodes, triangleCount());
+}
+
+void TriangleMesh::update()
+{
+    boundingBox = mesh->bounds;
+    transform = (boundingBox.low + boundingBox.high) / 2.0;
+}
+
+bool TriangleMesh::intersect(const TraversalRay& ray, HitData& data) const
+{
+    return traverse(ray, false, data);
+}
+
+bool TriangleMesh::occludes(const TraversalRay& ray) const
+{
+    HitData data;
+    return traverse(ray, true, data);
+}
+
+bool TriangleMesh::traverse(const TraversalRay& ray, const bool any_hit, HitData& data) const
+{
+    if (mesh->nodes.empty())
+    {
+        return false;
+    }
+
+    const ShearedRay sheared(ray.ray);
+    TraversalRay closest = ray;
+    bool found = false;
+    uint32_t stack[KDN::MAX_DEPTH * 2];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+    while (stack_size > 0)
+    {
+        const KDN &node = mesh->nodes[stack[--stack_size]];
+        if (!node.intersect(closest))
+        {
+            continue;
+        }
+
+        if (node.isLeaf())
+        {
+            for (uint32_t i = node.offset; i < node.offset + node.count; ++i)
+            {
+                const uint32_t *triangle = &mesh->indices[3 * i];
+                Real t, u, v;
+                if (intersect_triangle(sheared, mesh->positions[triangle[0]], mesh->positions[triangle[1]],
+                                       mesh->positions[triangle[2]], closest.t_min, closest.t_max, t, u, v))
+                {
+                    closest.t_max = t;
+                    data.t = t;
+                    data.entity = this;
+                    data.primitive = i;
+                    data.u = u;
+                    data.v = v;
+                    found = true;
+                    if (any_hit)
+                    {
+                        return true;
+                    }
+                }
+            }
+            continue;
+        }
+
+        const uint32_t near = closest.sign[node.axis];
+        stack[stack_size++] = node.offset + 1 - near;
+        stack[stack_size++] = node.offset + near;
+    }
+    return found;
+}
+
+void TriangleMesh::interact(const Ray& r, HitData& data) const
+{
+    const uint32_t *triangle = &mesh->indices[3 * data.primitive];
+    const Vec3 p0(mesh->positions[triangle[0]]);
+    const Vec3 p1(mesh->positions[triangle[1]]);
+    const Vec3 p2(mesh->positions[triangle[2]]);
+    // Interpolating the vertices keeps the hit point on the triangle's plane
+    data.hit_point = p0 * (1 - data.u - data.v) + p1 * data.u + p2 * data.v;
+    // Triangles are two sided, the normal faces the incoming ray
+    Vec3 normal = (p1 - p0).cross(p2 - p0).normalized();
+    if (normal.dot(r.direction()) > 0)
+    {
+        normal = -normal;
+    }
+    data.normal = normal;
+    data.material = material;
+}
+
+bool TriangleMesh::surfaceMaterial(MaterialId& material) const
+{
+    material = this->material;
+    return true;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "entity.hpp"
+#include "kdtree-node.hpp"
+#include "shared-array.hpp"
+
+// Vertex and index buffers of a triangle mesh together with a tree over its triangles.
+// Meshes can be shared between entities. The triangles are stored in leaf order, so every
+// leaf references a contiguous range of them. The arrays are either built from an OBJ file
+// or point into a mapped compiled scene.
+struct MeshData
+{
+    // Builds the tree and reorders the triangles to match it
+    void build();
+    size_t triangleCount() const { return indices.size() / 3; }
+    // Bytes used by the buffers and the tree
+    size_t memoryUsage() const;
+    // True if all indices are in range and the tree is safe to traverse, for meshes read from files
+    bool valid() const;
+
+    SharedArray<Vec3f> positions;
+    // Three vertex indices per triangle
+    SharedArray<uint32_t> indices;
+    SharedArray<KDN> nodes;
+    AABB bounds = AABB::empty();
+
+    static constexpr double TRIANGLE_INTERSECTION_COST = 1.5;
+};
+
+class TriangleMesh : public Entity
+{
+  public:
+    TriangleMesh(std::shared_ptr<const MeshData> mesh, MaterialId material)
+        : mesh(std::move(mesh))
+        , material(material)
+    {
+        TriangleMesh::update();
+    }
+    void update() override;
+    bool intersect(const TraversalRay& ray, HitData& data) const override;
+    bool occludes(const TraversalRay& ray) const override;
+    void interact(const Ray& r, HitData& data) const override;
+    bool surfaceMaterial(MaterialId& material) const override;
+    std::shared_ptr<const MeshData> mesh;
+    MaterialId material;
+
+  private:
+    // Walks the mesh tree. Stops at the first hit if `any_hit` is set, otherwise finds the closest one.
+    bool traverse(const TraversalRay& ray, const bool any_hit, HitData& data) const;
+};
@@ -4,187 +4,197 @@
 #include <cmath>
 #include <cstdlib>
 #include <iostream>
+#include <type_traits>
 
-class Vec3
+// Scalar type used for geometry, traversal and shading. Accumulated colors always use double.
+#ifdef RAYTRACER_SINGLE_PRECISION
+using Real = float;
+#else
+using Real = double;
+#endif
+
+template <typename T>
+class Vec3T
 {
     public:
-        explicit Vec3(double e0) { e[0] = e0; e[1] = e0; e[2] = e0; }
-        Vec3(double e0, double e1, double e2) { e[0] = e0; e[1] = e1; e[2] = e2; }
-        Vec3() { e[0] = 0; e[1] = 0; e[2] = 0; }
-        double x() const { return e[0]; }
-        double y() const { return e[1]; }
-        double z() const { return e[2]; }
-        double r() const { return e[0]; }
-        double g() const { return e[1]; }
-        double b() const { return e[2]; }
-
-        inline const Vec3& operator+() const { return *this; }
-        inline Vec3 operator-() const { return {-e[0], -e[1], -e[2]}; }
-        inline double operator[](int i) const { return e[i]; }
-        inline double& operator[](int i) { return e[i]; }
-
-        inline Vec3& operator+=(const Vec3 &v2);
-        inline Vec3& operator-=(const Vec3 &v2);
-        inline Vec3& operator*=(const Vec3 &v2);
-        inline Vec3& operator/=(const Vec3 &v2);
-        inline Vec3& operator*=(const double &f);
-        inline Vec3& operator/=(const double &f);
-
-        inline double dot(const Vec3 &v2) const;
-        inline Vec3 cross(const Vec3 &v2) const;
-        inline Vec3 reflect(const Vec3 &v) const;
-
-        double length() const
+#ifdef RAYTRACER_SIMD_VEC3
+        // Padded to four lanes so every operator maps to a single vector instruction
+        typedef T Storage __attribute__((vector_size(4 * sizeof(T))));
+#else
+        using Storage = std::array<T, 3>;
+#endif
+
+        explicit Vec3T(T e0) { e[0] = e0; e[1] = e0; e[2] = e0; }
+        Vec3T(T e0, T e1, T e2) { e[0] = e0; e[1] = e1; e[2] = e2; }
+        Vec3T() { e[0] = 0; e[1] = 0; e[2] = 0; }
+        template <typename U>
+        explicit Vec3T(const Vec3T<U> &v) { e[0] = v[0]; e[1] = v[1]; e[2] = v[2]; }
+        T x() const { return e[0]; }
+        T y() const { return e[1]; }
+        T z() const { return e[2]; }
+        T r() const { return e[0]; }
+        T g() const { return e[1]; }
+        T b() const { return e[2]; }
+
+        inline const Vec3T& operator+() const { return *this; }
+        inline Vec3T operator-() const { return map([](auto a) { return -a; }); }
+        inline T operator[](int i) const { return e[i]; }
+        inline T& operator[](int i) { return e[i]; }
+
+        inline Vec3T& operator+=(const Vec3T &v2) { return *this = *this + v2; }
+        inline Vec3T& operator-=(const Vec3T &v2) { return *this = *this - v2; }
+        inline Vec3T& operator*=(const Vec3T &v2) { return *this = *this * v2; }
+        inline Vec3T& operator/=(const Vec3T &v2) { return *this = *this / v2; }
+        inline Vec3T& operator*=(const T &f) { return *this = *this * f; }
+        inline Vec3T& operator/=(const T &f) { return *this = *this / f; }
+
+        inline T dot(const Vec3T &v2) const;
+        inline Vec3T cross(const Vec3T &v2) const;
+        inline Vec3T reflect(const Vec3T &v) const;
+
+        T length() const
         {
-            return sqrt(squaredLength());
+            return std::sqrt(squaredLength());
         }
-        double squaredLength() const
+        T squaredLength() const
         {
             return e[0]*e[0] + e[1]*e[1] + e[2]*e[2];
         }
         void normalize();
-        Vec3 normalized() const;
+        Vec3T normalized() const;
+
+        // Applies `op` to every component, a whole vector register at a time if possible
+        template <typename Op>
+        inline Vec3T map(Op op) const
+        {
+            Vec3T result;
+#ifdef RAYTRACER_SIMD_VEC3
+            result.e = op(e);
+#else
+            for (int i = 0; i < 3; ++i)
+            {
+                result.e[i] = op(e[i]);
+            }
+#endif
+            return result;
+        }
+
+        template <typename Op>
+        inline Vec3T map(const Vec3T &v, Op op) const
+        {
+            Vec3T result;
+#ifdef RAYTRACER_SIMD_VEC3
+            result.e = op(e, v.e);
+#else
+            for (int i = 0; i < 3; ++i)
+            {
+                result.e[i] = op(e[i], v.e[i]);
+            }
+#endif
+            return result;
+        }
 
-        std::array<double, 3> e = {};
+        Storage e = {};
 };
 
-inline Vec3 operator+(const Vec3 &v1, const Vec3 &v2);
-inline Vec3 operator-(const Vec3 &v1, const Vec3 &v2);
-inline Vec3 operator*(const Vec3 &v1, const Vec3 &v2);
-inline Vec3 operator/(const Vec3 &v1, const Vec3 &v2);
-inline Vec3 operator*(double f, Vec3 v);
-inline Vec3 operator*(Vec3 v, double f);
-inline Vec3 operator/(Vec3 v, double f);
-inline Vec3 operator/(double f, Vec3 v);
+using Vec3 = Vec3T<Real>;
+using Vec3f = Vec3T<float>;
+using Vec3d = Vec3T<double>;
 
-inline std::istream& operator>>(std::istream &is, Vec3 &v)
+template <typename T>
+inline std::istream& operator>>(std::istream &is, Vec3T<T> &v)
 {
-    is >> v.e[0] >> v.e[1] >> v.e[2];
+    T x, y, z;
+    is >> x >> y >> z;
+    v = Vec3T<T>(x, y, z);
     return is;
 }
 
-inline std::ostream& operator<<(std::ostream &os, const Vec3 &v)
+template <typename T>
+inline std::ostream& operator<<(std::ostream &os, const Vec3T<T> &v)
 {
-    os << v.e[0] << " " << v.e[1] << " " << v.e[2];
+    os << v[0] << " " << v[1] << " " << v[2];
     return os;
 }
 
-
-inline Vec3& Vec3::operator+=(const Vec3 &v)
-{
-    e[0] += v[0];
-    e[1] += v[1];
-    e[2] += v[2];
-    return *this;
-}
-
-inline Vec3& Vec3::operator-=(const Vec3 &v)
-{
-    e[0] -= v[0];
-    e[1] -= v[1];
-    e[2] -= v[2];
-    return *this;
-}
-
-inline Vec3& Vec3::operator*=(const Vec3 &v)
+template <typename T>
+inline Vec3T<T> operator+(const Vec3T<T> &v1, const Vec3T<T> &v2)
 {
-    e[0] *= v[0];
-    e[1] *= v[1];
-    e[2] *= v[2];
-    return *this;
+    return v1.map(v2, [](auto a, auto b) { return a + b; });
 }
 
-inline Vec3& Vec3::operator/=(const Vec3 &v)
+template <typename T>
+inline Vec3T<T> operator-(const Vec3T<T> &v1, const Vec3T<T> &v2)
 {
-    e[0] /= v[0];
-    e[1] /= v[1];
-    e[2] /= v[2];
-    return *this;
+    return v1.map(v2, [](auto a, auto b) { return a - b; });
 }
 
-inline Vec3& Vec3::operator*=(const double &f)
+template <typename T>
+inline Vec3T<T> operator*(const Vec3T<T> &v1, const Vec3T<T> &v2)
 {
-    e[0] *= f;
-    e[1] *= f;
-    e[2] *= f;
-    return *this;
+    return v1.map(v2, [](auto a, auto b) { return a * b; });
 }
 
-inline Vec3& Vec3::operator/=(const double &f)
+template <typename T>
+inline Vec3T<T> operator/(const Vec3T<T> &v1, const Vec3T<T> &v2)
 {
-    e[0] /= f;
-    e[1] /= f;
-    e[2] /= f;
-    return *this;
+    return v1.map(v2, [](auto a, auto b) { return a / b; });
 }
 
-inline Vec3 operator+(const Vec3 &v1, const Vec3 &v2)
+// Scalar factors may be of any arithmetic type, they are converted to the component type
+template <typename T, typename S, typename = std::enable_if_t<std::is_arithmetic_v<S>>>
+inline Vec3T<T> operator*(const S f, const Vec3T<T> &v)
 {
-    return {v1[0] + v2[0], v1[1] + v2[1], v1[2] + v2[2]};
+    return v.map([f = static_cast<T>(f)](auto a) { return a * f; });
 }
 
-inline Vec3 operator-(const Vec3 &v1, const Vec3 &v2)
+template <typename T, typename S, typename = std::enable_if_t<std::is_arithmetic_v<S>>>
+inline Vec3T<T> operator*(const Vec3T<T> &v, const S f)
 {
-    return {v1[0] - v2[0], v1[1] - v2[1], v1[2] - v2[2]};
+    return v.map([f = static_cast<T>(f)](auto a) { return a * f; });
 }
 
-inline Vec3 operator*(const Vec3 &v1, const Vec3 &v2)
+template <typename T, typename S, typename = std::enable_if_t<std::is_arithmetic_v<S>>>
+inline Vec3T<T> operator/(const Vec3T<T> &v, const S f)
 {
-    return {v1[0] * v2[0], v1[1] * v2[1], v1[2] * v2[2]};
+    return v.map([f = static_cast<T>(f)](auto a) { return a / f; });
 }
 
-inline Vec3 operator/(const Vec3 &v1, const Vec3 &v2)
+template <typename T, typename S, typename = std::enable_if_t<std::is_arithmetic_v<S>>>
+inline Vec3T<T> operator/(const S f, const Vec3T<T> &v)
 {
-    return {v1[0] / v2[0], v1[1] / v2[1], v1[2] / v2[2]};
+    return v.map([f = static_cast<T>(f)](auto a) { return f / a; });
 }
 
-inline Vec3 operator*(const double f, const Vec3 v)
-{
-    return {v[0] * f, v[1] * f, v[2] * f};
-}
-
-inline Vec3 operator*(const Vec3 v, const double f)
-{
-    return {v[0] * f, v[1] * f, v[2] * f};
-}
-
-inline Vec3 operator/(const Vec3 v, const double f)
-{
-    return {v[0] / f, v[1] / f, v[2] / f};
-}
-
-inline Vec3 operator/(const double f, const Vec3 v)
-{
-    return {f / v[0], f / v[1], f / v[2]};
-}
-
-inline double Vec3::dot(const Vec3 &v2) const
+template <typename T>
+inline T Vec3T<T>::dot(const Vec3T &v2) const
 {
     return e[0] * v2[0] + e[1] * v2[1] + e[2] * v2[2];
 }
 
-inline Vec3 Vec3::cross(const Vec3 &v2) const
+template <typename T>
+inline Vec3T<T> Vec3T<T>::cross(const Vec3T &v2) const
 {
     return {(e[1] * v2[2] - e[2] * v2[1]),
            -(e[0] * v2[2] - e[2] * v2[0]),
             (e[0] * v2[1] - e[1] * v2[0])};
 }
 
-inline Vec3 Vec3::reflect(const Vec3 &v) const
+template <typename T>
+inline Vec3T<T> Vec3T<T>::reflect(const Vec3T &v) const
 {
     return v - 2.0f * dot(v) * (*this);
 }
 
-inline void Vec3::normalize()
+template <typename T>
+inline void Vec3T<T>::normalize()
 {
-    double d = length();
-    e[0] /= d;
-    e[1] /= d;
-    e[2] /= d;
+    *this = normalized();
 }
 
-inline Vec3 Vec3::normalized() const
+template <typename T>
+inline Vec3T<T> Vec3T<T>::normalized() const
 {
-    double d = length();
-    return {e[0] / d, e[1] / d, e[2] / d};
-}
\ No newline at end of file
+    const T d = length();
+    return *this / d;
+}
@@ -0,0 +1,370 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "entity.hpp"
+#include "kdtree-scene.hpp"
+#include "material.hpp"
+#include "ray.hpp"
+#include "ray-packet.hpp"
+#include "sampler.hpp"
+#include "shading.hpp"
+#include "vec3.hpp"
+
+// Path tracer that advances a whole batch of paths one stage at a time instead of following every
+// sample through recursive castRay() calls:
+//
+//   generate    camera rays are added in groups, one group per pixel packet
+//   extend      the closest hit of every active path, camera rays as packets
+//   shade       light samples are queued as shadow rays and the next ray is scattered
+//   shadow      all queued shadow rays are tested in one pass
+//   accumulate  the direct light of the bounce is completed, terminated paths are compacted away
+//
+// Path state is kept as structure of arrays. Shading uses the helpers of shading.hpp and draws the
+// sample values of a path in the same order as shade(), and the bounces are folded into the path
+// color in the same order as the recursion does, so both integrators produce the same image.
+class Wavefront
+{
+    public:
+        // Drops all paths of the previous batch
+        void clear();
+        // Adds the camera rays of one pixel packet, `samplers` continue into the paths' shading
+        void addGroup(const Ray *rays, const Sampler *samplers, const int size);
+        // Traces all paths to the end. Camera rays are intersected as packets if `packets` is set.
+        void trace(const KDTreeScene &scene, const PathSettings &settings, const bool packets);
+
+        size_t size() const { return samplers_.size(); }
+        const Vec3& color(const size_t path) const { return colors_[path]; }
+        // Distance to the first hit, RAY_T_MAX for misses
+        Real depth(const size_t path) const { return depths_[path]; }
+        // Normal and albedo of the first hit, zero for misses
+        const Vec3& normal(const size_t path) const { return firstNormals_[path]; }
+        const Vec3& albedo(const size_t path) const { return albedos_[path]; }
+
+    private:
+        struct Group
+        {
+            uint32_t first;
+            int size;
+        };
+
+        Ray ray(const uint32_t path) const { return Ray(origins_[path], directions_[path]); }
+        HitData hitData(const uint32_t path) const;
+        void recordHit(const uint32_t path, const bool hit, const HitData &data);
+
+        void extendCamera(const KDTreeScene &scene, const bool packets);
+        // Keeps the camera rays' hits for normal() and albedo()
+        void recordFirstHits(const KDTreeScene &scene);
+        void extend(const KDTreeScene &scene);
+        void shade(const KDTreeScene &scene);
+        void shadow(const KDTreeScene &scene);
+        void accumulate(const KDTreeScene &scene);
+        // Folds the bounces of every path into its color, innermost first like the recursion
+        void resolve();
+
+        std::vector<Group> groups_;
+        // Paths still being traced
+        std::vector<uint32_t> active_;
+        int depth_ = 0;
+        PathSettings settings_ = {};
+        // Bounces a path can have, maxDepth + 1
+        int maxBounces_ = 0;
+
+        // Per path
+        std::vector<Vec3> origins_;
+        std::vector<Vec3> directions_;
+        std::vector<Sampler> samplers_;
+        std::vector<Real> depths_;
+        std::vector<Vec3> firstNormals_;
+        std::vector<Vec3> albedos_;
+        std::vector<int> bounces_;
+        std::vector<Vec3> colors_;
+        // Attenuation collected along the path, steering the Russian roulette
+        std::vector<Vec3> throughputs_;
+        // maxBounces_ entries per path: the light gathered at every bounce and the attenuation of
+        // the light arriving from the next one
+        std::vector<Vec3> radiance_;
+        std::vector<Vec3> attenuation_;
+
+        // Hit of the current bounce, per path
+        std::vector<uint8_t> hits_;
+        // Set if the path continues with a scattered ray
+        std::vector<uint8_t> scattered_;
+        std::vector<Vec3> hitPoints_;
+        std::vector<Vec3> normals_;
+        std::vector<MaterialId> materials_;
+        std::vector<const Entity*> entities_;
+        std::vector<double> sunlight_;
+
+        // Shadow rays of the current bounce, sun rays carry no contribution
+        std::vector<Vec3> shadowOrigins_;
+        std::vector<Vec3> shadowDirections_;
+        std::vector<Real> shadowTMax_;
+        std::vector<uint32_t> shadowPaths_;
+        std::vector<uint8_t> shadowSun_;
+        std::vector<Vec3> shadowContributions_;
+};
+
+void Wavefront::clear()
+{
+    groups_.clear();
+    origins_.clear();
+    directions_.clear();
+    samplers_.clear();
+}
+
+void Wavefront::addGroup(const Ray *rays, const Sampler *samplers, const int size)
+{
+    groups_.push_back({static_cast<uint32_t>(samplers_.size()), size});
+    for (int lane = 0; lane < size; ++lane)
+    {
+        origins_.push_back(rays[lane].origin());
+        directions_.push_back(rays[lane].direction());
+        samplers_.push_back(samplers[lane]);
+    }
+}
+
+void Wavefront::trace(const KDTreeScene &scene, const PathSettings &settings, const bool packets)
+{
+    settings_ = settings;
+    maxBounces_ = settings.maxDepth + 1;
+    const size_t count = size();
+    depths_.assign(count, RAY_T_MAX);
+    firstNormals_.assign(count, Vec3(0.0f));
+    albedos_.assign(count, Vec3(0.0f));
+    bounces_.assign(count, 0);
+    throughputs_.assign(count, Vec3(1.0f));
+    colors_.assign(count, Vec3(0.0f));
+    radiance_.assign(count * maxBounces_, Vec3(0.0f));
+    attenuation_.assign(count * maxBounces_, Vec3(0.0f));
+    hits_.assign(count, 0);
+    scattered_.assign(count, 0);
+    hitPoints_.resize(count);
+    normals_.resize(count);
+    materials_.resize(count);
+    entities_.resize(count);
+    sunlight_.resize(count);
+    active_.resize(count);
+    for (uint32_t path = 0; path < count; ++path)
+    {
+        active_[path] = path;
+    }
+
+    for (depth_ = 0; !active_.empty(); ++depth_)
+    {
+        if (depth_ == 0)
+        {
+            extendCamera(scene, packets);
+            recordFirstHits(scene);
+        }
+        else
+        {
+            extend(scene);
+        }
+        shade(scene);
+        shadow(scene);
+        accumulate(scene);
+    }
+    resolve();
+}
+
+HitData Wavefront::hitData(const uint32_t path) const
+{
+    HitData data;
+    data.hit_point = hitPoints_[path];
+    data.normal = normals_[path];
+    data.material = materials_[path];
+    data.entity = entities_[path];
+    return data;
+}
+
+void Wavefront::recordHit(const uint32_t path, const bool hit, const HitData &data)
+{
+    hits_[path] = hit;
+    if (hit)
+    {
+        hitPoints_[path] = data.hit_point;
+        normals_[path] = data.normal;
+        materials_[path] = data.material;
+        entities_[path] = data.entity;
+    }
+}
+
+void Wavefront::extendCamera(const KDTreeScene &scene, const bool packets)
+{
+    for (const Group &group : groups_)
+    {
+        if (!packets)
+        {
+            for (uint32_t path = group.first; path < group.first + group.size; ++path)
+            {
+                HitData data;
+                recordHit(path, scene.hit(ray(path), RAY_T_MIN, RAY_T_MAX, data), data);
+                depths_[path] = data.t;
+            }
+            continue;
+        }
+
+        // Same packet traversal as castPacket()
+        Ray rays[PACKET_SIZE];
+        HitPacket data;
+        for (int lane = 0; lane < group.size; ++lane)
+        {
+            rays[lane] = ray(group.first + lane);
+            data[lane].t = RAY_T_MAX;
+        }
+        const RayPacket packet(rays, group.size);
+        PacketReal closest = Simd::broadcast(RAY_T_MAX);
+        const PacketMask hits = scene.hitPacket(packet, packet.active, RAY_T_MIN, closest, data);
+        for (int lane = 0; lane < group.size; ++lane)
+        {
+            if (hits[lane])
+            {
+                data[lane].entity->interact(rays[lane], data[lane]);
+            }
+            recordHit(group.first + lane, hits[lane] != 0, data[lane]);
+            depths_[group.first + lane] = data[lane].t;
+        }
+    }
+}
+
+void Wavefront::recordFirstHits(const KDTreeScene &scene)
+{
+    for (uint32_t path = 0; path < size(); ++path)
+    {
+        if (hits_[path])
+        {
+            firstNormals_[path] = normals_[path];
+            albedos_[path] = surface_albedo(scene.materials[materials_[path]]);
+        }
+    }
+}
+
+void Wavefront::extend(const KDTreeScene &scene)
+{
+    for (const uint32_t path : active_)
+    {
+        HitData data;
+        recordHit(path, scene.hit(ray(path), RAY_T_MIN, RAY_T_MAX, data), data);
+    }
+}
+
+void Wavefront::shade(const KDTreeScene &scene)
+{
+    shadowOrigins_.clear();
+    shadowDirections_.clear();
+    shadowTMax_.clear();
+    shadowPaths_.clear();
+    shadowSun_.clear();
+    shadowContributions_.clear();
+    const auto queue = [&](const uint32_t path, const Ray &r, const Real t_max, const bool sun, const Vec3 &contribution) {
+        shadowOrigins_.push_back(r.origin());
+        shadowDirections_.push_back(r.direction());
+        shadowTMax_.push_back(t_max);
+        shadowPaths_.push_back(path);
+        shadowSun_.push_back(sun);
+        shadowContributions_.push_back(contribution);
+    };
+
+    for (const uint32_t path : active_)
+    {
+        const Ray r = ray(path);
+        Vec3 &radiance = radiance_[path * maxBounces_ + depth_];
+        bounces_[path] = depth_ + 1;
+        if (!hits_[path])
+        {
+            radiance = sky(r);
+            continue;
+        }
+
+        const HitData data = hitData(path);
+        const Material &material = scene.materials[data.material];
+        Sampler &sampler = samplers_[path];
+        sampler.beginBounce(depth_);
+        queue(path, sun_ray(data), RAY_T_MAX, true, Vec3(0.0f));
+        for (int i = 0; i < LIGHT_SAMPLES; ++i)
+        {
+            Ray lightray;
+            Real t_max;
+            Vec3 contribution;
+            if (sample_light(scene, data, material, sampler, lightray, t_max, contribution))
+            {
+                queue(path, lightray, t_max, false, contribution);
+            }
+        }
+
+        // The scattered ray replaces the path's ray if it survives the depth limits and the roulette
+        Ray scattered;
+        Vec3 &attenuation = attenuation_[path * maxBounces_ + depth_];
+        scattered_[path] = can_scatter(settings_, depth_, material)
+            && material.scatter(r, data, attenuation, scattered, sampler)
+            && continue_path(settings_, depth_, throughputs_[path], attenuation, sampler);
+        if (scattered_[path])
+        {
+            origins_[path] = scattered.origin();
+            directions_[path] = scattered.direction();
+            throughputs_[path] *= attenuation;
+        }
+    }
+}
+
+void Wavefront::shadow(const KDTreeScene &scene)
+{
+    for (uint32_t path : active_)
+    {
+        sunlight_[path] = 1.0f;
+    }
+    for (size_t i = 0; i < shadowPaths_.size(); ++i)
+    {
+        const uint32_t path = shadowPaths_[i];
+        const bool occluded = scene.occluded(Ray(shadowOrigins_[i], shadowDirections_[i]), RAY_T_MIN, shadowTMax_[i]);
+        if (shadowSun_[i])
+        {
+            sunlight_[path] = occluded ? SUN_SHADOW : 1.0f;
+        }
+        else if (!occluded)
+        {
+            radiance_[path * maxBounces_ + depth_] += shadowContributions_[i];
+        }
+    }
+}
+
+void Wavefront::accumulate(const KDTreeScene &scene)
+{
+    size_t kept = 0;
+    for (const uint32_t path : active_)
+    {
+        if (!hits_[path])
+        {
+            continue;
+        }
+        const Material &material = scene.materials[materials_[path]];
+        Vec3 &radiance = radiance_[path * maxBounces_ + depth_];
+        radiance += material.ambient;
+        radiance += material.emissive;
+        radiance += material.diffuse * sunlight_[path];
+        if (scattered_[path])
+        {
+            active_[kept++] = path;
+        }
+    }
+    active_.resize(kept);
+}
+
+void Wavefront::resolve()
+{
+    for (uint32_t path = 0; path < size(); ++path)
+    {
+        const Vec3 *radiance = &radiance_[path * maxBounces_];
+        const Vec3 *attenuation = &attenuation_[path * maxBounces_];
+        Vec3 color = radiance[bounces_[path] - 1];
+        for (int bounce = bounces_[path] - 2; bounce >= 0; --bounce)
+        {
+            Vec3 local = radiance[bounce];
+            local += attenuation[bounce] * color;
+            color = local;
+        }
+        colors_[path] = color;
+    }
+}